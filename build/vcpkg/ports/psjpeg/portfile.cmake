@@ -16,7 +16,8 @@ vcpkg_from_github(
         psjpeg-customize-code.patch
 )
 
-file(COPY ${CURRENT_PORT_DIR}/psjpeg.h ${CURRENT_PORT_DIR}/psjpeg.c ${CURRENT_PORT_DIR}/psjpeg.ver DESTINATION ${SOURCE_PATH})
+file(COPY ${CURRENT_PORT_DIR}/psjpeg.h ${CURRENT_PORT_DIR}/psjpeg.c ${CURRENT_PORT_DIR}/psjpeg.ver ${CURRENT_PORT_DIR}/psjpegbench.c
+          ${CURRENT_PORT_DIR}/psjpegtest.c DESTINATION ${SOURCE_PATH})
 
 if(VCPKG_TARGET_ARCHITECTURE STREQUAL "wasm32")
     set(LIBJPEGTURBO_SIMD -DWITH_SIMD=OFF)
@@ -41,6 +42,8 @@ vcpkg_check_features(OUT_FEATURE_OPTIONS FEATURE_OPTIONS
     FEATURES
         jpeg7 WITH_JPEG7
         jpeg8 WITH_JPEG8
+        bench PSJPEG_BENCH
+        test PSJPEG_TEST
 )
 
 vcpkg_cmake_configure(
@@ -67,6 +70,14 @@ vcpkg_cmake_configure(
 vcpkg_cmake_install()
 vcpkg_copy_pdbs()
 
+if("bench" IN_LIST FEATURES)
+    vcpkg_copy_tools(TOOL_NAMES psjpegbench AUTO_CLEAN)
+endif()
+
+if("test" IN_LIST FEATURES)
+    vcpkg_copy_tools(TOOL_NAMES psjpegtest AUTO_CLEAN)
+endif()
+
 vcpkg_fixup_pkgconfig()
 vcpkg_cmake_config_fixup(CONFIG_PATH lib/cmake/libjpeg-turbo)
 
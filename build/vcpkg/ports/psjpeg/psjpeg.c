@@ -1,9 +1,21 @@
 // Copyright © Clinton Ingram and Contributors.  Licensed under the MIT License.
 
 #include <setjmp.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#define JPEG_INTERNALS
 #include "jerror.h"
 #include "jinclude.h"
 #include "psjpeg.h"
+#include "jmemsys.h"
+#include "transupp.h"
 
 #if defined(__GNUC__) && defined(__x86_64__)
 #include <mm_malloc.h>
@@ -25,6 +37,10 @@
 #define TRY int _jmp_res; if (!(_jmp_res = SETJMP(((ps_error_mgr*)cinfo->err)->jmp_buf)))
 #define CATCH else
 #define TRY_RESULT !_jmp_res ? TRUE : FALSE;
+// Redirects errors raised on a second handle to the TRY handle, carrying the message along.
+#define CHAIN(other) if (SETJMP(((ps_error_mgr*)(other)->err)->jmp_buf)) { \
+	memcpy(((ps_error_mgr*)cinfo->err)->msg, ((ps_error_mgr*)(other)->err)->msg, JMSG_LENGTH_MAX); \
+	LONGJMP(((ps_error_mgr*)cinfo->err)->jmp_buf, 1); }
 
 #define JMP_BUF_ALIGN 16
 #define JMP_BUF_OFFS (sizeof(struct jpeg_error_mgr) + JMSG_LENGTH_MAX)
@@ -32,6 +48,8 @@
 #define MSG_BUF_SIZE (JMSG_LENGTH_MAX + MSG_BUF_PAD)
 #define SRC_BUF_SIZE 4096
 #define DST_BUF_SIZE 4096
+#define MIN_BUF_SIZE 512
+#define MT_MAX_THREADS 64
 
 typedef struct {
 	struct jpeg_error_mgr pub;
@@ -42,13 +60,98 @@ typedef struct {
 typedef struct {
 	struct jpeg_destination_mgr pub;
 	JOCTET* buff;
+	size_t buff_size;
+	JOCTET* mem;
+	size_t mem_size;
+	size_t mem_len;
+	JHUFF_TBL huff_tbls[2 * NUM_HUFF_TBLS];
+	boolean huff_saved[2 * NUM_HUFF_TBLS];
 } ps_dest_mgr;
 
 typedef struct {
 	struct jpeg_source_mgr pub;
 	JOCTET* buff;
+	size_t buff_size;
+	size_t buff_alloc;
+	JOCTET* buff_heap;
+	const JOCTET* mem;
+	size_t mem_len;
+	size_t mem_read;
+	size_t* rst_offs;
+	JDIMENSION rst_count;
+	JDIMENSION rst_size;
+	size_t scan_offs;
+	size_t scan_end;
+	boolean indexed;
 } ps_src_mgr;
 
+typedef struct {
+	struct jpeg_source_mgr pub;
+	const JOCTET* mem;
+	const size_t* rst_offs;
+	JDIMENSION rst_count;
+	size_t scan_offs;
+	size_t scan_end;
+	JOCTET* head;
+	size_t head_len;
+	JDIMENSION first;
+	JDIMENSION next;
+	JDIMENSION last;
+	boolean marker;
+} ps_band_src;
+
+// Header for arena allocations.  Two pointer-sized fields keep the payload at malloc alignment on 64-bit targets.
+typedef struct ps_arena_block {
+	struct ps_arena_block* next;
+	size_t size;
+} ps_arena_block;
+
+struct ps_arena {
+	ps_allocator backing;
+	ps_arena_block* cache;
+	size_t cached;
+	size_t limit;
+};
+
+typedef struct ps_mt_task {
+	void(*work)(struct ps_mt_task* task);
+} ps_mt_task;
+
+typedef struct {
+	ps_mt_task task;
+	j_decompress_ptr master;
+	JOCTET* head;
+	size_t head_len;
+	JDIMENSION first;
+	JDIMENSION last;
+	JDIMENSION skip;
+	JDIMENSION row;
+	JDIMENSION rows;
+	JSAMPARRAY scanlines;
+	JSAMPIMAGE planes;
+	int status;
+	char msg[JMSG_LENGTH_MAX];
+} ps_band;
+
+typedef struct {
+	ps_mt_task task;
+	j_compress_ptr master;
+	JDIMENSION row;
+	JDIMENSION rows;
+	JDIMENSION restart;
+	JSAMPARRAY scanlines;
+	JSAMPIMAGE planes;
+	JOCTET* out;
+	size_t out_len;
+	int status;
+	char msg[JMSG_LENGTH_MAX];
+} ps_strip;
+
+typedef struct {
+	ps_strip* strips;
+	int count;
+} ps_strip_list;
+
 static void nullEmit(j_common_ptr cinfo, int msg_level) { }
 static void nullOutput(j_common_ptr cinfo) { }
 
@@ -70,23 +173,185 @@ static void abortExcessiveProgressive(j_common_ptr cinfo)
 	LONGJMP(err->jmp_buf, 1);
 }
 
+static void* defaultAlloc(void* state, size_t size) {
+	return malloc(size);
+}
+
+static void defaultFree(void* state, void* mem) {
+	free(mem);
+}
+
+static ps_arena* createArena(const ps_allocator* allocator, size_t limit) {
+	ps_arena* arena = (ps_arena*)malloc(sizeof(ps_arena));
+	if (!arena)
+		return NULL;
+
+	if (allocator) {
+		arena->backing = *allocator;
+	} else {
+		arena->backing.state = NULL;
+		arena->backing.alloc = defaultAlloc;
+		arena->backing.free = defaultFree;
+	}
+
+	arena->cache = NULL;
+	arena->cached = 0;
+	arena->limit = limit;
+
+	return arena;
+}
+
+static void destroyArena(ps_arena* arena) {
+	if (!arena)
+		return;
+
+	while (arena->cache) {
+		ps_arena_block* blk = arena->cache;
+		arena->cache = blk->next;
+		(*arena->backing.free)(arena->backing.state, blk);
+	}
+
+	free(arena);
+}
+
+static void* arenaAlloc(ps_arena* arena, size_t size) {
+	// Best fit from the blocks released by earlier images, refusing any more than twice the request so a
+	// large cached block isn't pinned by a small pool.  The pool sizes repeat from image to image, so most
+	// requests after the first image are satisfied here.
+	ps_arena_block** best = NULL;
+	for (ps_arena_block** pblk = &arena->cache; *pblk; pblk = &(*pblk)->next) {
+		size_t bsize = (*pblk)->size;
+		if (bsize >= size && bsize - size <= size && (!best || bsize < (*best)->size))
+			best = pblk;
+	}
+
+	ps_arena_block* blk;
+	if (best) {
+		blk = *best;
+		*best = blk->next;
+		arena->cached -= blk->size;
+	} else {
+		if (size > SIZE_MAX - sizeof(ps_arena_block))
+			return NULL;
+
+		blk = (ps_arena_block*)(*arena->backing.alloc)(arena->backing.state, size + sizeof(ps_arena_block));
+		if (!blk)
+			return NULL;
+
+		blk->size = size;
+	}
+
+	return blk + 1;
+}
+
+static void arenaFree(ps_arena* arena, void* mem) {
+	if (!mem)
+		return;
+
+	ps_arena_block* blk = (ps_arena_block*)mem - 1;
+	if (arena->cached + blk->size <= arena->limit) {
+		blk->next = arena->cache;
+		arena->cache = blk;
+		arena->cached += blk->size;
+	} else {
+		(*arena->backing.free)(arena->backing.state, blk);
+	}
+}
+
+// These replace jmemnobs.c, so every pool the memory manager creates for a handle goes through that handle's arena.
+// Handles without one (including the band and strip workers, which may run concurrently) use the C heap directly.
+static ps_arena* getArena(j_common_ptr cinfo) {
+	return cinfo->client_data ? ((ps_client_data*)cinfo->client_data)->arena : NULL;
+}
+
+GLOBAL(void*) jpeg_get_small(j_common_ptr cinfo, size_t sizeofobject) {
+	ps_arena* arena = getArena(cinfo);
+	return arena ? arenaAlloc(arena, sizeofobject) : malloc(sizeofobject);
+}
+
+GLOBAL(void) jpeg_free_small(j_common_ptr cinfo, void* object, size_t sizeofobject) {
+	ps_arena* arena = getArena(cinfo);
+	if (arena)
+		arenaFree(arena, object);
+	else
+		free(object);
+}
+
+GLOBAL(void*) jpeg_get_large(j_common_ptr cinfo, size_t sizeofobject) {
+	return jpeg_get_small(cinfo, sizeofobject);
+}
+
+GLOBAL(void) jpeg_free_large(j_common_ptr cinfo, void* object, size_t sizeofobject) {
+	jpeg_free_small(cinfo, object, sizeofobject);
+}
+
+GLOBAL(size_t) jpeg_mem_available(j_common_ptr cinfo, size_t min_bytes_needed, size_t max_bytes_needed, size_t already_allocated) {
+	if (cinfo->mem->max_memory_to_use)
+		return (size_t)cinfo->mem->max_memory_to_use > already_allocated ? cinfo->mem->max_memory_to_use - already_allocated : 0;
+
+	return max_bytes_needed;
+}
+
+GLOBAL(void) jpeg_open_backing_store(j_common_ptr cinfo, backing_store_ptr info, long total_bytes_needed) {
+	ERREXIT(cinfo, JERR_NO_BACKING_STORE);
+}
+
+GLOBAL(long) jpeg_mem_init(j_common_ptr cinfo) {
+	return 0;
+}
+
+GLOBAL(void) jpeg_mem_term(j_common_ptr cinfo) { }
+
+static uint64_t ticks() {
+#ifdef _WIN32
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER count;
+	if (!freq.QuadPart)
+		QueryPerformanceFrequency(&freq);
+
+	QueryPerformanceCounter(&count);
+	return (uint64_t)(count.QuadPart / freq.QuadPart) * 1000000000 + (uint64_t)(count.QuadPart % freq.QuadPart) * 1000000000 / (uint64_t)freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static ps_jpeg_stats* getStats(j_common_ptr cinfo) {
+	return &((ps_client_data*)cinfo->client_data)->stats;
+}
+
+// Charges an exported call to its stage whether or not it succeeded, so failed reads still show where time went.
+static void endStage(j_common_ptr cinfo, int stage, uint64_t start, JDIMENSION rows) {
+	ps_jpeg_stats* stats = getStats(cinfo);
+	stats->stage_ns[stage] += ticks() - start;
+	stats->rows += rows;
+}
+
 static void initDest(j_compress_ptr cinfo) {
 	ps_dest_mgr* dest = (ps_dest_mgr*)cinfo->dest;
 
-	dest->buff = (JOCTET*)(*cinfo->mem->alloc_small)((j_common_ptr)cinfo, JPOOL_IMAGE, DST_BUF_SIZE * sizeof(JOCTET));
+	dest->buff = (JOCTET*)(*cinfo->mem->alloc_large)((j_common_ptr)cinfo, JPOOL_IMAGE, dest->buff_size * sizeof(JOCTET));
 	dest->pub.next_output_byte = dest->buff;
-	dest->pub.free_in_buffer = DST_BUF_SIZE;
+	dest->pub.free_in_buffer = dest->buff_size;
 }
 
 static boolean writeDest(j_compress_ptr cinfo) {
 	ps_client_data* client = (ps_client_data*)cinfo->client_data;
 	ps_dest_mgr* dest = (ps_dest_mgr*)cinfo->dest;
 
-	if ((*client->write_callback)(client->stream_handle, dest->buff, DST_BUF_SIZE) != DST_BUF_SIZE)
+	uint64_t start = ticks();
+	size_t cb = (*client->write_callback)(client->stream_handle, dest->buff, dest->buff_size);
+	client->stats.callback_ns += ticks() - start;
+	client->stats.write_calls++;
+	if (cb != dest->buff_size)
 		ERREXIT(cinfo, JERR_FILE_WRITE);
 
+	client->stats.bytes_out += cb;
+
 	dest->pub.next_output_byte = dest->buff;
-	dest->pub.free_in_buffer = DST_BUF_SIZE;
+	dest->pub.free_in_buffer = dest->buff_size;
 
 	return TRUE;
 }
@@ -94,10 +359,60 @@ static boolean writeDest(j_compress_ptr cinfo) {
 static void termDest(j_compress_ptr cinfo) {
 	ps_client_data* client = (ps_client_data*)cinfo->client_data;
 	ps_dest_mgr* dest = (ps_dest_mgr*)cinfo->dest;
-	size_t cb = DST_BUF_SIZE - dest->pub.free_in_buffer;
+	size_t cb = dest->buff_size - dest->pub.free_in_buffer;
+	if (cb == 0)
+		return;
 
-	if (cb > 0 && (*client->write_callback)(client->stream_handle, dest->buff, cb) != cb)
+	uint64_t start = ticks();
+	size_t written = (*client->write_callback)(client->stream_handle, dest->buff, cb);
+	client->stats.callback_ns += ticks() - start;
+	client->stats.write_calls++;
+	if (written != cb)
 		ERREXIT(cinfo, JERR_FILE_WRITE);
+
+	client->stats.bytes_out += cb;
+}
+
+static void initMemDest(j_compress_ptr cinfo) {
+	ps_dest_mgr* dest = (ps_dest_mgr*)cinfo->dest;
+
+	if (!dest->mem) {
+		dest->mem = (JOCTET*)malloc(dest->buff_size * sizeof(JOCTET));
+		if (!dest->mem)
+			ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 10);
+
+		dest->mem_size = dest->buff_size;
+	}
+
+	dest->mem_len = 0;
+	dest->pub.next_output_byte = dest->mem;
+	dest->pub.free_in_buffer = dest->mem_size;
+}
+
+static boolean growMemDest(j_compress_ptr cinfo) {
+	ps_dest_mgr* dest = (ps_dest_mgr*)cinfo->dest;
+	size_t size = dest->mem_size * 2;
+
+	JOCTET* mem = (JOCTET*)realloc(dest->mem, size * sizeof(JOCTET));
+	if (!mem)
+		ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 10);
+
+	dest->pub.next_output_byte = mem + dest->mem_size;
+	dest->pub.free_in_buffer = size - dest->mem_size;
+	dest->mem = mem;
+	dest->mem_size = size;
+
+	return TRUE;
+}
+
+static void termMemDest(j_compress_ptr cinfo) {
+	ps_dest_mgr* dest = (ps_dest_mgr*)cinfo->dest;
+
+	dest->mem_len = dest->mem_size - dest->pub.free_in_buffer;
+
+	// Strip workers have no client data.  Their output is counted when the master emits it.
+	if (cinfo->client_data)
+		getStats((j_common_ptr)cinfo)->bytes_out += dest->mem_len;
 }
 
 static void initSource(j_decompress_ptr cinfo) {
@@ -111,10 +426,15 @@ static boolean fillSource(j_decompress_ptr cinfo) {
 	ps_client_data* client = (ps_client_data*)cinfo->client_data;
 	ps_src_mgr* src = (ps_src_mgr*)cinfo->src;
 
-  size_t cb = (*client->read_callback)(client->stream_handle, src->buff, SRC_BUF_SIZE);
+	uint64_t start = ticks();
+	size_t cb = (*client->read_callback)(client->stream_handle, src->buff, src->buff_size);
+	client->stats.callback_ns += ticks() - start;
+	client->stats.read_calls++;
 	if (cb == ~0)
 		ERREXIT(cinfo, JERR_FILE_READ);
 
+	client->stats.bytes_in += cb;
+
 	if (cb == 0) {
 		// EOF reached -- fabricate an EOI marker
 		src->buff[0] = (JOCTET)0xFF;
@@ -135,7 +455,11 @@ static void skipSource(j_decompress_ptr cinfo, long num_bytes) {
 
 	if (cb > src->pub.bytes_in_buffer) {
 		cb -= src->pub.bytes_in_buffer;
+
+		uint64_t start = ticks();
 		cb = (*client->seek_callback)(client->stream_handle, cb);
+		client->stats.callback_ns += ticks() - start;
+		client->stats.seek_calls++;
 		if (cb == ~0)
 			ERREXIT(cinfo, JERR_FILE_READ);
 
@@ -147,6 +471,164 @@ static void skipSource(j_decompress_ptr cinfo, long num_bytes) {
 	}
 }
 
+static void initMemSource(j_decompress_ptr cinfo) {
+	ps_src_mgr* src = (ps_src_mgr*)cinfo->src;
+
+	src->mem_read = 0;
+	src->pub.next_input_byte = src->mem;
+	src->pub.bytes_in_buffer = src->mem_len;
+}
+
+// Adds the bytes consumed since the last call to the input count.  jpeg_abort doesn't call term_source,
+// so the abort paths call this directly.
+static void countMemSource(j_decompress_ptr cinfo) {
+	ps_src_mgr* src = (ps_src_mgr*)cinfo->src;
+	const JOCTET* next = src->pub.next_input_byte;
+	if (!src->mem || !next || !cinfo->client_data)
+		return;
+
+	// Outside the buffer, the source is reading the EOI marker fabricated by fillMemSource.
+	size_t pos = next >= src->mem && next <= src->mem + src->mem_len ? (size_t)(next - src->mem) : src->mem_len;
+	if (pos > src->mem_read) {
+		getStats((j_common_ptr)cinfo)->bytes_in += pos - src->mem_read;
+		src->mem_read = pos;
+	}
+}
+
+static void termMemSource(j_decompress_ptr cinfo) {
+	countMemSource(cinfo);
+}
+
+static boolean fillMemSource(j_decompress_ptr cinfo) {
+	static const JOCTET eoi[] = { (JOCTET)0xFF, (JOCTET)JPEG_EOI };
+	ps_src_mgr* src = (ps_src_mgr*)cinfo->src;
+
+	// The whole image is already in the buffer, so reaching this means it was truncated -- fabricate an EOI marker
+	src->pub.next_input_byte = eoi;
+	src->pub.bytes_in_buffer = sizeof(eoi);
+
+	return TRUE;
+}
+
+static void skipMemSource(j_decompress_ptr cinfo, long num_bytes) {
+	ps_src_mgr* src = (ps_src_mgr*)cinfo->src;
+	size_t cb = (size_t)num_bytes;
+
+	if (num_bytes <= 0)
+		return;
+
+	if (cb > src->pub.bytes_in_buffer)
+		cb = src->pub.bytes_in_buffer;
+
+	src->pub.next_input_byte += cb;
+	src->pub.bytes_in_buffer -= cb;
+}
+
+static void initBandSource(j_decompress_ptr cinfo) {
+	ps_band_src* src = (ps_band_src*)cinfo->src;
+
+	src->pub.next_input_byte = src->head;
+	src->pub.bytes_in_buffer = src->head_len;
+	src->next = src->first;
+	src->marker = FALSE;
+}
+
+static boolean fillBandSource(j_decompress_ptr cinfo) {
+	static const JOCTET markers[][2] = {
+		{ 0xFF, JPEG_RST0 }, { 0xFF, JPEG_RST0 + 1 }, { 0xFF, JPEG_RST0 + 2 }, { 0xFF, JPEG_RST0 + 3 },
+		{ 0xFF, JPEG_RST0 + 4 }, { 0xFF, JPEG_RST0 + 5 }, { 0xFF, JPEG_RST0 + 6 }, { 0xFF, JPEG_RST0 + 7 },
+		{ 0xFF, JPEG_EOI }
+	};
+	ps_band_src* src = (ps_band_src*)cinfo->src;
+
+	// Serve the band's restart intervals straight from the source buffer.  The markers between them are
+	// renumbered so the band decoder sees the sequence it would expect at the top of an image.
+	do {
+		if (src->marker) {
+			src->pub.next_input_byte = markers[(src->next - src->first - 1) & 7];
+			src->pub.bytes_in_buffer = 2;
+			src->marker = FALSE;
+		} else if (src->next < src->last) {
+			size_t start = src->next ? src->rst_offs[src->next - 1] + 2 : src->scan_offs;
+			size_t end = src->next < src->rst_count ? src->rst_offs[src->next] : src->scan_end;
+
+			src->pub.next_input_byte = src->mem + start;
+			src->pub.bytes_in_buffer = end - start;
+			src->marker = ++src->next < src->last;
+		} else {
+			src->pub.next_input_byte = markers[8];
+			src->pub.bytes_in_buffer = 2;
+		}
+	} while (!src->pub.bytes_in_buffer);
+
+	return TRUE;
+}
+
+static void skipBandSource(j_decompress_ptr cinfo, long num_bytes) {
+	struct jpeg_source_mgr* src = cinfo->src;
+
+	if (num_bytes <= 0)
+		return;
+
+	while ((size_t)num_bytes > src->bytes_in_buffer) {
+		num_bytes -= (long)src->bytes_in_buffer;
+		(*src->fill_input_buffer)(cinfo);
+	}
+
+	src->next_input_byte += num_bytes;
+	src->bytes_in_buffer -= num_bytes;
+}
+
+static void termBandSource(j_decompress_ptr cinfo) { }
+
+#ifdef _WIN32
+static DWORD WINAPI threadProc(LPVOID arg) {
+	ps_mt_task* task = (ps_mt_task*)arg;
+	(*task->work)(task);
+	return 0;
+}
+#else
+static void* threadProc(void* arg) {
+	ps_mt_task* task = (ps_mt_task*)arg;
+	(*task->work)(task);
+	return NULL;
+}
+#endif
+
+static void runParallel(ps_mt_task** tasks, int count) {
+	// Workers have their own error managers, so each one leaves its result in its task for the calling thread to check.
+#ifdef _WIN32
+	HANDLE threads[MT_MAX_THREADS];
+	for (int i = 1; i < count; i++)
+		threads[i] = CreateThread(NULL, 0, threadProc, tasks[i], 0, NULL);
+
+	(*tasks[0]->work)(tasks[0]);
+
+	for (int i = 1; i < count; i++) {
+		if (threads[i]) {
+			WaitForSingleObject(threads[i], INFINITE);
+			CloseHandle(threads[i]);
+		} else {
+			(*tasks[i]->work)(tasks[i]);
+		}
+	}
+#else
+	pthread_t threads[MT_MAX_THREADS];
+	int started[MT_MAX_THREADS];
+	for (int i = 1; i < count; i++)
+		started[i] = pthread_create(&threads[i], NULL, threadProc, tasks[i]) == 0;
+
+	(*tasks[0]->work)(tasks[0]);
+
+	for (int i = 1; i < count; i++) {
+		if (started[i])
+			pthread_join(threads[i], NULL);
+		else
+			(*tasks[i]->work)(tasks[i]);
+	}
+#endif
+}
+
 static struct jpeg_error_mgr* setErr(ps_error_mgr* err) {
 	struct jpeg_error_mgr* jerr = (struct jpeg_error_mgr*)err;
 
@@ -159,10 +641,85 @@ static struct jpeg_error_mgr* setErr(ps_error_mgr* err) {
 	return jerr;
 }
 
+static void resetErr(ps_error_mgr* err) {
+	err->pub.num_warnings = 0;
+	err->pub.msg_code = 0;
+	err->msg[0] = '\0';
+}
+
+static void resetDest(ps_dest_mgr* dest, boolean mem) {
+	// A memory destination buffer is kept across resets and reused by the next image.
+	dest->mem_len = 0;
+	dest->pub.init_destination = mem ? initMemDest : initDest;
+	dest->pub.empty_output_buffer = mem ? growMemDest : writeDest;
+	dest->pub.term_destination = mem ? termMemDest : termDest;
+}
+
+static void resetSource(ps_src_mgr* src, const JOCTET* buff, size_t len) {
+	// The restart index allocation is likewise kept; only its contents are invalidated.
+	src->mem = buff;
+	src->mem_len = buff ? len : 0;
+	src->mem_read = 0;
+	src->rst_count = 0;
+	src->indexed = FALSE;
+	src->pub.init_source = buff ? initMemSource : initSource;
+	src->pub.fill_input_buffer = buff ? fillMemSource : fillSource;
+	src->pub.skip_input_data = buff ? skipMemSource : skipSource;
+	src->pub.term_source = buff ? termMemSource : initSource;
+	src->pub.next_input_byte = NULL;
+	src->pub.bytes_in_buffer = 0;
+}
+
+// Optimized Huffman tables are generated in place, and jpeg_set_defaults won't replace a table that already exists,
+// so the tables a handle started with are saved here and put back on reset.
+static void saveHuffTables(j_compress_ptr cinfo) {
+	ps_dest_mgr* dest = (ps_dest_mgr*)cinfo->dest;
+
+	// Only optimized coding changes the tables, and libjpeg turns it on for progressive scripts.
+	if (!cinfo->optimize_coding && !cinfo->scan_info)
+		return;
+
+	// Tables saved since the last reset are the originals.  The handle's own may have been optimized since.
+	for (int i = 0; i < 2 * NUM_HUFF_TBLS; i++) {
+		if (dest->huff_saved[i])
+			return;
+	}
+
+	for (int i = 0; i < NUM_HUFF_TBLS; i++) {
+		JHUFF_TBL* tbls[] = { cinfo->dc_huff_tbl_ptrs[i], cinfo->ac_huff_tbl_ptrs[i] };
+		for (int j = 0; j < 2; j++) {
+			dest->huff_saved[i * 2 + j] = tbls[j] != NULL;
+			if (tbls[j])
+				dest->huff_tbls[i * 2 + j] = *tbls[j];
+		}
+	}
+}
+
+static void restoreHuffTables(j_compress_ptr cinfo) {
+	ps_dest_mgr* dest = (ps_dest_mgr*)cinfo->dest;
+
+	for (int i = 0; i < NUM_HUFF_TBLS; i++) {
+		JHUFF_TBL* tbls[] = { cinfo->dc_huff_tbl_ptrs[i], cinfo->ac_huff_tbl_ptrs[i] };
+		for (int j = 0; j < 2; j++) {
+			if (tbls[j] && dest->huff_saved[i * 2 + j]) {
+				*tbls[j] = dest->huff_tbls[i * 2 + j];
+				tbls[j]->sent_table = FALSE;
+			}
+		}
+	}
+
+	memset(dest->huff_saved, 0, sizeof(dest->huff_saved));
+}
+
 static void setDest(j_compress_ptr cinfo) {
 	ps_dest_mgr* dest = (*cinfo->mem->alloc_small)((j_common_ptr)cinfo, JPOOL_PERMANENT, sizeof(ps_dest_mgr));
 
 	dest->buff = NULL;
+	dest->buff_size = DST_BUF_SIZE;
+	dest->mem = NULL;
+	dest->mem_size = 0;
+	dest->mem_len = 0;
+	memset(dest->huff_saved, 0, sizeof(dest->huff_saved));
 	dest->pub.init_destination = initDest;
 	dest->pub.empty_output_buffer = writeDest;
 	dest->pub.term_destination = termDest;
@@ -173,7 +730,19 @@ static void setDest(j_compress_ptr cinfo) {
 static void setSource(j_decompress_ptr cinfo) {
 	ps_src_mgr* src = (*cinfo->mem->alloc_small)((j_common_ptr)cinfo, JPOOL_PERMANENT, sizeof(ps_src_mgr));
 
-	src->buff = (JOCTET*)(*cinfo->mem->alloc_small)((j_common_ptr)cinfo, JPOOL_PERMANENT, SRC_BUF_SIZE * sizeof(JOCTET));
+	src->buff = (JOCTET*)(*cinfo->mem->alloc_large)((j_common_ptr)cinfo, JPOOL_PERMANENT, SRC_BUF_SIZE * sizeof(JOCTET));
+	src->buff_size = SRC_BUF_SIZE;
+	src->buff_alloc = SRC_BUF_SIZE;
+	src->buff_heap = NULL;
+	src->mem = NULL;
+	src->mem_len = 0;
+	src->mem_read = 0;
+	src->rst_offs = NULL;
+	src->rst_count = 0;
+	src->rst_size = 0;
+	src->scan_offs = 0;
+	src->scan_end = 0;
+	src->indexed = FALSE;
 	src->pub.init_source = initSource;
 	src->pub.fill_input_buffer = fillSource;
 	src->pub.skip_input_data = skipSource;
@@ -185,15 +754,732 @@ static void setSource(j_decompress_ptr cinfo) {
 	cinfo->src = (struct jpeg_source_mgr*)src;
 }
 
+static void setBandSource(j_decompress_ptr cinfo, ps_band* band) {
+	ps_src_mgr* msrc = (ps_src_mgr*)band->master->src;
+	ps_band_src* src = (*cinfo->mem->alloc_small)((j_common_ptr)cinfo, JPOOL_PERMANENT, sizeof(ps_band_src));
+
+	src->mem = msrc->mem;
+	src->rst_offs = msrc->rst_offs;
+	src->rst_count = msrc->rst_count;
+	src->scan_offs = msrc->scan_offs;
+	src->scan_end = msrc->scan_end;
+	src->head = band->head;
+	src->head_len = band->head_len;
+	src->first = band->first;
+	src->next = band->first;
+	src->last = band->last;
+	src->marker = FALSE;
+	src->pub.init_source = initBandSource;
+	src->pub.fill_input_buffer = fillBandSource;
+	src->pub.skip_input_data = skipBandSource;
+	src->pub.resync_to_restart = jpeg_resync_to_restart;
+	src->pub.term_source = termBandSource;
+	src->pub.next_input_byte = NULL;
+	src->pub.bytes_in_buffer = 0;
+
+	cinfo->src = (struct jpeg_source_mgr*)src;
+}
+
+static void indexRestarts(j_decompress_ptr cinfo) {
+	ps_src_mgr* src = (ps_src_mgr*)cinfo->src;
+	const JOCTET* mem = src->mem;
+	size_t len = src->mem_len;
+
+	src->rst_count = 0;
+	src->scan_offs = len;
+	src->scan_end = len;
+
+	// After the header is read, the source points at the first byte of entropy-coded data, unless the input was truncated.
+	if (src->pub.next_input_byte >= mem && src->pub.next_input_byte <= mem + len) {
+		size_t pos = src->scan_offs = (size_t)(src->pub.next_input_byte - mem);
+
+		while (len - pos > 1) {
+			const JOCTET* ff = (const JOCTET*)memchr(mem + pos, 0xFF, len - pos - 1);
+			if (!ff)
+				break;
+
+			pos = (size_t)(ff - mem);
+			int marker = mem[pos + 1];
+			if (marker == 0 || marker == 0xFF) {
+				// stuffed zero, or fill byte ahead of a marker
+				pos += marker ? 1 : 2;
+				continue;
+			}
+
+			if (marker < JPEG_RST0 || marker > JPEG_RST0 + 7) {
+				src->scan_end = pos;
+				break;
+			}
+
+			if (src->rst_count == src->rst_size) {
+				JDIMENSION size = src->rst_size ? src->rst_size * 2 : 256;
+				size_t* offs = (size_t*)realloc(src->rst_offs, size * sizeof(size_t));
+				if (!offs)
+					ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 10);
+
+				src->rst_offs = offs;
+				src->rst_size = size;
+			}
+
+			src->rst_offs[src->rst_count++] = pos;
+			pos += 2;
+		}
+	}
+
+	src->indexed = TRUE;
+}
+
+static size_t buildBandHeader(j_decompress_ptr cinfo, JOCTET* head, size_t* sof) {
+	ps_src_mgr* src = (ps_src_mgr*)cinfo->src;
+	const JOCTET* mem = src->mem;
+	size_t end = src->scan_offs, pos = 2, len = 2;
+
+	// Band decoders need only the tables, frame and scan headers, plus the JFIF and Adobe markers
+	// that determine the color space.  Anything libjpeg skipped over as garbage means we don't fully
+	// understand the header, so the caller falls back to sequential decoding.
+	if (end < 2 || mem[0] != 0xFF || mem[1] != 0xD8)
+		return 0;
+
+	memcpy(head, mem, 2);
+	*sof = 0;
+
+	while (pos < end) {
+		while (end - pos > 1 && mem[pos] == 0xFF && mem[pos + 1] == 0xFF)
+			pos++;
+
+		if (end - pos < 4 || mem[pos] != 0xFF)
+			return 0;
+
+		int marker = mem[pos + 1];
+		size_t seg = 2 + ((size_t)mem[pos + 2] << 8 | mem[pos + 3]);
+		if (seg > end - pos)
+			return 0;
+
+		if ((marker > JPEG_APP0 && marker <= JPEG_APP0 + 15 && marker != JPEG_APP0 + 14) || marker == JPEG_COM) {
+			pos += seg;
+			continue;
+		}
+
+		// SOFn, excluding DHT, JPG and DAC
+		if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+			*sof = len;
+
+		memcpy(head + len, mem + pos, seg);
+		len += seg;
+		pos += seg;
+	}
+
+	return *sof ? len : 0;
+}
+
+static void readRows(j_decompress_ptr cinfo, JSAMPARRAY scanlines, JSAMPIMAGE planes, JDIMENSION row, JDIMENSION rows) {
+	// Raw data is read one iMCU row at a time, so row and rows are in iMCU rows for that mode.
+	if (cinfo->raw_data_out) {
+		JSAMPARRAY data[MAX_COMPONENTS];
+		JDIMENSION lines = cinfo->max_v_samp_factor * cinfo->min_DCT_scaled_size;
+
+		for (JDIMENSION i = row; i < row + rows; i++) {
+			for (int ci = 0; ci < cinfo->num_components; ci++) {
+				jpeg_component_info* comp = &cinfo->comp_info[ci];
+				data[ci] = planes[ci] + (size_t)i * comp->v_samp_factor * comp->DCT_scaled_size;
+			}
+
+			if (!jpeg_read_raw_data(cinfo, data, lines))
+				ERREXIT(cinfo, JERR_TOO_LITTLE_DATA);
+		}
+
+		return;
+	}
+
+	for (JDIMENSION done = 0; done < rows;) {
+		JDIMENSION lines = jpeg_read_scanlines(cinfo, scanlines + row + done, rows - done);
+		if (!lines)
+			ERREXIT(cinfo, JERR_TOO_LITTLE_DATA);
+
+		done += lines;
+	}
+}
+
+static void decodeBand(ps_mt_task* task) {
+	ps_band* band = (ps_band*)task;
+	j_decompress_ptr master = band->master;
+	struct jpeg_decompress_struct info;
+	j_decompress_ptr cinfo = &info;
+
+	ps_error_mgr* err = (ps_error_mgr*)_mm_malloc(sizeof(ps_error_mgr), JMP_BUF_ALIGN);
+	if (!err) {
+		SNPRINTF(band->msg, JMSG_LENGTH_MAX, "Insufficient memory to start band decoder.");
+		band->status = FALSE;
+		return;
+	}
+
+	memset(cinfo, 0, sizeof(struct jpeg_decompress_struct));
+	cinfo->err = setErr(err);
+
+	TRY {
+		jpeg_create_decompress(cinfo);
+		setBandSource(cinfo, band);
+		jpeg_read_header(cinfo, TRUE);
+
+		cinfo->jpeg_color_space = master->jpeg_color_space;
+		cinfo->out_color_space = master->out_color_space;
+		cinfo->scale_num = master->scale_num;
+		cinfo->scale_denom = master->scale_denom;
+		cinfo->output_gamma = master->output_gamma;
+		cinfo->raw_data_out = master->raw_data_out;
+		cinfo->dct_method = master->dct_method;
+		cinfo->do_fancy_upsampling = master->do_fancy_upsampling;
+		cinfo->do_block_smoothing = master->do_block_smoothing;
+		jpeg_start_decompress(cinfo);
+
+		// Rows are written straight into the caller's buffers, which are sized for the master's output.
+		if (cinfo->output_width != master->output_width || cinfo->output_components != master->output_components) {
+			SNPRINTF(band->msg, JMSG_LENGTH_MAX, "Band decoder output does not match the image.");
+			band->status = FALSE;
+		} else {
+			if (band->skip)
+				jpeg_skip_scanlines(cinfo, band->skip);
+
+			readRows(cinfo, band->scanlines, band->planes, band->row, band->rows);
+			band->status = TRUE;
+		}
+	} CATCH {
+		memcpy(band->msg, err->msg, JMSG_LENGTH_MAX);
+		band->status = FALSE;
+	}
+
+	jpeg_destroy_decompress(cinfo);
+	_mm_free(err);
+}
+
+static JDIMENSION gcd(JDIMENSION a, JDIMENSION b) {
+	while (b) {
+		JDIMENSION t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+static boolean decodeParallel(j_decompress_ptr cinfo, JSAMPARRAY scanlines, JSAMPIMAGE planes, int threads) {
+	ps_src_mgr* src = (ps_src_mgr*)cinfo->src;
+	jpeg_component_info* comp = cinfo->comp_info;
+	boolean context = FALSE;
+
+	if (threads < 2 || !src->mem || !cinfo->restart_interval || cinfo->progressive_mode || cinfo->comps_in_scan != cinfo->num_components)
+		return FALSE;
+
+	// Bands only carry the output settings copied in decodeBand.  Color quantization and buffered-image
+	// mode change the output format or need state from the whole image, so those decode sequentially.
+	if (cinfo->quantize_colors || cinfo->buffered_image)
+		return FALSE;
+
+	if (cinfo->num_components == 1 && (comp->h_samp_factor != 1 || comp->v_samp_factor != 1))
+		return FALSE;
+
+	// Vertically upsampled chroma is interpolated from the neighboring rows, so each band must decode
+	// an extra aligned unit on each side and throw those rows away.
+	for (int ci = 0; ci < cinfo->num_components; ci++)
+		context |= !cinfo->raw_data_out && comp[ci].v_samp_factor < cinfo->max_v_samp_factor;
+
+	if (!src->indexed)
+		indexRestarts(cinfo);
+
+	JDIMENSION restart = cinfo->restart_interval;
+	JDIMENSION mcus = cinfo->num_components == 1 ? comp->width_in_blocks : (JDIMENSION)jdiv_round_up(cinfo->image_width, cinfo->max_h_samp_factor * DCTSIZE);
+	JDIMENSION imcus = cinfo->total_iMCU_rows;
+	JDIMENSION intervals = (JDIMENSION)(((size_t)mcus * imcus + restart - 1) / restart);
+	if (src->rst_count + 1 != intervals)
+		return FALSE;
+
+	// A band can only start on an iMCU row that also starts a restart interval.
+	JDIMENSION unit = restart / gcd(restart, mcus);
+	JDIMENSION units = (imcus + unit - 1) / unit;
+	int count = threads < MT_MAX_THREADS ? threads : MT_MAX_THREADS;
+	if ((JDIMENSION)count > units)
+		count = (int)units;
+
+	if (count < 2)
+		return FALSE;
+
+	size_t sof;
+	JOCTET* head = (JOCTET*)(*cinfo->mem->alloc_large)((j_common_ptr)cinfo, JPOOL_IMAGE, src->scan_offs * sizeof(JOCTET));
+	size_t head_len = buildBandHeader(cinfo, head, &sof);
+	if (!head_len)
+		return FALSE;
+
+	JDIMENSION row_height = cinfo->max_v_samp_factor * DCTSIZE;
+	JDIMENSION out_height = cinfo->max_v_samp_factor * cinfo->min_DCT_scaled_size;
+	ps_band* bands = (ps_band*)(*cinfo->mem->alloc_small)((j_common_ptr)cinfo, JPOOL_IMAGE, count * sizeof(ps_band));
+	ps_mt_task* tasks[MT_MAX_THREADS];
+
+	for (int i = 0; i < count; i++) {
+		ps_band* band = &bands[i];
+		JDIMENSION u0 = (JDIMENSION)((size_t)units * i / count);
+		JDIMENSION u1 = (JDIMENSION)((size_t)units * (i + 1) / count);
+		JDIMENSION r0 = u0 * unit, r1 = MIN(u1 * unit, imcus);
+		JDIMENSION d0 = (u0 - (context && u0 > 0)) * unit, d1 = MIN((u1 + (context && u1 < units)) * unit, imcus);
+		JDIMENSION height = MIN(d1 * row_height, cinfo->image_height) - d0 * row_height;
+
+		// Each band decodes a standalone image made of the shared header, patched to the band's height, and its restart intervals.
+		band->head = (JOCTET*)(*cinfo->mem->alloc_large)((j_common_ptr)cinfo, JPOOL_IMAGE, head_len * sizeof(JOCTET));
+		memcpy(band->head, head, head_len);
+		band->head[sof + 5] = (JOCTET)(height >> 8);
+		band->head[sof + 6] = (JOCTET)(height & 0xFF);
+
+		band->task.work = decodeBand;
+		band->master = cinfo;
+		band->head_len = head_len;
+		band->first = (JDIMENSION)((size_t)d0 * mcus / restart);
+		band->last = d1 == imcus ? intervals : (JDIMENSION)((size_t)d1 * mcus / restart);
+		band->scanlines = scanlines;
+		band->planes = planes;
+
+		if (cinfo->raw_data_out) {
+			band->skip = 0;
+			band->row = r0;
+			band->rows = r1 - r0;
+		} else {
+			band->skip = (r0 - d0) * out_height;
+			band->row = r0 * out_height;
+			band->rows = MIN(r1 * out_height, cinfo->output_height) - band->row;
+		}
+
+		tasks[i] = &band->task;
+	}
+
+	runParallel(tasks, count);
+
+	for (int i = 0; i < count; i++) {
+		if (!bands[i].status) {
+			ps_error_mgr* err = (ps_error_mgr*)cinfo->err;
+			memcpy(err->msg, bands[i].msg, JMSG_LENGTH_MAX);
+
+			LONGJMP(err->jmp_buf, 1);
+		}
+	}
+
+	// The bands consumed the rest of the scan and the marker that ends it, as a sequential decode would have.
+	size_t end = MIN(src->scan_end + 2, src->mem_len);
+	src->pub.next_input_byte = src->mem + end;
+	src->pub.bytes_in_buffer = src->mem_len - end;
+
+	return TRUE;
+}
+
+static void emitBytes(j_compress_ptr cinfo, const JOCTET* data, size_t len) {
+	struct jpeg_destination_mgr* dest = cinfo->dest;
+
+	while (len) {
+		if (!dest->free_in_buffer && !(*dest->empty_output_buffer)(cinfo))
+			ERREXIT(cinfo, JERR_CANT_SUSPEND);
+
+		size_t cb = MIN(len, dest->free_in_buffer);
+		memcpy(dest->next_output_byte, data, cb);
+		dest->next_output_byte += cb;
+		dest->free_in_buffer -= cb;
+		data += cb;
+		len -= cb;
+	}
+}
+
+static boolean findScan(const JOCTET* buff, size_t len, size_t* sof, size_t* scan) {
+	size_t pos = 2;
+
+	*sof = 0;
+	while (len >= pos + 4 && buff[pos] == 0xFF) {
+		int marker = buff[pos + 1];
+
+		// SOFn, excluding DHT, JPG and DAC
+		if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+			*sof = pos;
+
+		pos += 2 + ((size_t)buff[pos + 2] << 8 | buff[pos + 3]);
+		if (marker == 0xDA) {
+			*scan = pos;
+			return *sof && len >= pos + 2;
+		}
+	}
+
+	return FALSE;
+}
+
+static void writeRows(j_compress_ptr cinfo, JSAMPARRAY scanlines, JSAMPIMAGE planes, JDIMENSION row, JDIMENSION rows) {
+	// Raw data is written one iMCU row at a time, so row and rows are in iMCU rows for that mode.
+	if (cinfo->raw_data_in) {
+		JSAMPARRAY data[MAX_COMPONENTS];
+		JDIMENSION lines = cinfo->max_v_samp_factor * DCTSIZE;
+
+		for (JDIMENSION i = row; i < row + rows; i++) {
+			for (int ci = 0; ci < cinfo->num_components; ci++)
+				data[ci] = planes[ci] + (size_t)i * cinfo->comp_info[ci].v_samp_factor * DCTSIZE;
+
+			if (!jpeg_write_raw_data(cinfo, data, lines))
+				ERREXIT(cinfo, JERR_CANT_SUSPEND);
+		}
+
+		return;
+	}
+
+	for (JDIMENSION done = 0; done < rows;) {
+		JDIMENSION lines = jpeg_write_scanlines(cinfo, scanlines + row + done, rows - done);
+		if (!lines)
+			ERREXIT(cinfo, JERR_CANT_SUSPEND);
+
+		done += lines;
+	}
+}
+
+static void encodeStrip(ps_mt_task* task) {
+	ps_strip* strip = (ps_strip*)task;
+	j_compress_ptr master = strip->master;
+	struct jpeg_compress_struct info;
+	j_compress_ptr cinfo = &info;
+	ps_dest_mgr* volatile dest = NULL;
+
+	ps_error_mgr* err = (ps_error_mgr*)_mm_malloc(sizeof(ps_error_mgr), JMP_BUF_ALIGN);
+	if (!err) {
+		SNPRINTF(strip->msg, JMSG_LENGTH_MAX, "Insufficient memory to start strip encoder.");
+		strip->status = FALSE;
+		return;
+	}
+
+	memset(cinfo, 0, sizeof(struct jpeg_compress_struct));
+	cinfo->err = setErr(err);
+
+	TRY {
+		JDIMENSION row_height = master->max_v_samp_factor * DCTSIZE;
+		JDIMENSION top = strip->row * row_height;
+
+		jpeg_create_compress(cinfo);
+		setDest(cinfo);
+		dest = (ps_dest_mgr*)cinfo->dest;
+		dest->buff_size = DST_BUF_SIZE * 16;
+		resetDest(dest, TRUE);
+
+		cinfo->image_width = master->image_width;
+		cinfo->image_height = MIN((strip->row + strip->rows) * row_height, master->image_height) - top;
+		cinfo->input_components = master->input_components;
+		cinfo->in_color_space = master->in_color_space;
+		jpeg_set_defaults(cinfo);
+		jpeg_set_colorspace(cinfo, master->jpeg_color_space);
+
+		// Every strip must share the master's tables, since only the first strip's are written to the output.
+		for (int ci = 0; ci < cinfo->num_components; ci++) {
+			jpeg_component_info* comp = &cinfo->comp_info[ci];
+			jpeg_component_info* mcomp = &master->comp_info[ci];
+
+			comp->component_id = mcomp->component_id;
+			comp->h_samp_factor = mcomp->h_samp_factor;
+			comp->v_samp_factor = mcomp->v_samp_factor;
+			comp->quant_tbl_no = mcomp->quant_tbl_no;
+			comp->dc_tbl_no = mcomp->dc_tbl_no;
+			comp->ac_tbl_no = mcomp->ac_tbl_no;
+		}
+
+		for (int i = 0; i < NUM_QUANT_TBLS; i++) {
+			if (!master->quant_tbl_ptrs[i])
+				continue;
+
+			if (!cinfo->quant_tbl_ptrs[i])
+				cinfo->quant_tbl_ptrs[i] = jpeg_alloc_quant_table((j_common_ptr)cinfo);
+
+			memcpy(cinfo->quant_tbl_ptrs[i]->quantval, master->quant_tbl_ptrs[i]->quantval, sizeof(master->quant_tbl_ptrs[i]->quantval));
+		}
+
+		for (int i = 0; i < NUM_HUFF_TBLS; i++) {
+			if (master->dc_huff_tbl_ptrs[i]) {
+				if (!cinfo->dc_huff_tbl_ptrs[i])
+					cinfo->dc_huff_tbl_ptrs[i] = jpeg_alloc_huff_table((j_common_ptr)cinfo);
+
+				memcpy(cinfo->dc_huff_tbl_ptrs[i]->bits, master->dc_huff_tbl_ptrs[i]->bits, sizeof(master->dc_huff_tbl_ptrs[i]->bits));
+				memcpy(cinfo->dc_huff_tbl_ptrs[i]->huffval, master->dc_huff_tbl_ptrs[i]->huffval, sizeof(master->dc_huff_tbl_ptrs[i]->huffval));
+			}
+
+			if (master->ac_huff_tbl_ptrs[i]) {
+				if (!cinfo->ac_huff_tbl_ptrs[i])
+					cinfo->ac_huff_tbl_ptrs[i] = jpeg_alloc_huff_table((j_common_ptr)cinfo);
+
+				memcpy(cinfo->ac_huff_tbl_ptrs[i]->bits, master->ac_huff_tbl_ptrs[i]->bits, sizeof(master->ac_huff_tbl_ptrs[i]->bits));
+				memcpy(cinfo->ac_huff_tbl_ptrs[i]->huffval, master->ac_huff_tbl_ptrs[i]->huffval, sizeof(master->ac_huff_tbl_ptrs[i]->huffval));
+			}
+		}
+
+		cinfo->write_JFIF_header = FALSE;
+		cinfo->write_Adobe_marker = FALSE;
+		cinfo->raw_data_in = master->raw_data_in;
+		cinfo->CCIR601_sampling = master->CCIR601_sampling;
+		cinfo->dct_method = master->dct_method;
+		cinfo->restart_interval = strip->restart;
+		jpeg_start_compress(cinfo, TRUE);
+
+		writeRows(cinfo, strip->scanlines, strip->planes, cinfo->raw_data_in ? strip->row : top, cinfo->raw_data_in ? strip->rows : cinfo->image_height);
+		jpeg_finish_compress(cinfo);
+
+		strip->out = dest->mem;
+		strip->out_len = dest->mem_len;
+		dest->mem = NULL;
+		strip->status = TRUE;
+	} CATCH {
+		memcpy(strip->msg, err->msg, JMSG_LENGTH_MAX);
+		strip->status = FALSE;
+	}
+
+	if (dest)
+		free(dest->mem);
+
+	jpeg_destroy_compress(cinfo);
+	_mm_free(err);
+}
+
+static boolean encodeParallel(j_compress_ptr cinfo, JSAMPARRAY scanlines, JSAMPIMAGE planes, int threads, ps_strip_list* list) {
+	jpeg_component_info* comp = cinfo->comp_info;
+
+	if (threads < 2 || cinfo->scan_info || cinfo->optimize_coding || cinfo->arith_code || cinfo->smoothing_factor || cinfo->data_precision != 8 || cinfo->comps_in_scan != cinfo->num_components)
+		return FALSE;
+
+	if (cinfo->num_components == 1 && (comp->h_samp_factor != 1 || comp->v_samp_factor != 1))
+		return FALSE;
+
+	JDIMENSION mcus = cinfo->num_components == 1 ? comp->width_in_blocks : (JDIMENSION)jdiv_round_up(cinfo->image_width, cinfo->max_h_samp_factor * DCTSIZE);
+	JDIMENSION imcus = cinfo->total_iMCU_rows;
+	JDIMENSION interval, group;
+	int count = threads < MT_MAX_THREADS ? threads : MT_MAX_THREADS;
+
+	// Strips end on restart interval boundaries.  A strip holding a single interval can be placed anywhere, since its
+	// marker is written here.  A strip holding several must start on a multiple of 8 intervals so its own markers are numbered correctly.
+	if (cinfo->restart_interval) {
+		if (cinfo->restart_interval % mcus)
+			return FALSE;
+
+		interval = cinfo->restart_interval / mcus;
+		JDIMENSION intervals = (imcus + interval - 1) / interval;
+		group = intervals <= (JDIMENSION)count ? 1 : (intervals + count * 8 - 1) / (count * 8) * 8;
+	} else {
+		interval = MIN((imcus + count - 1) / count, 65535 / mcus);
+		group = 1;
+	}
+
+	JDIMENSION rows = interval * group;
+	JDIMENSION strips = (imcus + rows - 1) / rows;
+	if (strips < 2 || !interval)
+		return FALSE;
+
+	list->strips = (ps_strip*)(*cinfo->mem->alloc_large)((j_common_ptr)cinfo, JPOOL_IMAGE, strips * sizeof(ps_strip));
+	memset(list->strips, 0, strips * sizeof(ps_strip));
+	list->count = (int)strips;
+
+	for (JDIMENSION i = 0; i < strips; i++) {
+		ps_strip* strip = &list->strips[i];
+
+		strip->task.work = encodeStrip;
+		strip->master = cinfo;
+		strip->row = i * rows;
+		strip->rows = MIN(rows, imcus - strip->row);
+		strip->restart = interval * mcus;
+		strip->scanlines = scanlines;
+		strip->planes = planes;
+	}
+
+	for (JDIMENSION first = 0; first < strips; first += count) {
+		ps_mt_task* tasks[MT_MAX_THREADS];
+		int batch = (int)MIN((JDIMENSION)count, strips - first);
+
+		for (int i = 0; i < batch; i++)
+			tasks[i] = &list->strips[first + i].task;
+
+		runParallel(tasks, batch);
+
+		for (int i = 0; i < batch; i++) {
+			ps_strip* strip = &list->strips[first + i];
+			size_t sof, scan = 0;
+
+			if (!strip->status) {
+				ps_error_mgr* err = (ps_error_mgr*)cinfo->err;
+				memcpy(err->msg, strip->msg, JMSG_LENGTH_MAX);
+
+				LONGJMP(err->jmp_buf, 1);
+			}
+
+			if (!findScan(strip->out, strip->out_len, &sof, &scan))
+				ERREXIT(cinfo, JERR_BAD_LENGTH);
+
+			if (first + i == 0) {
+				// The first strip supplies the tables, frame and scan headers, with its height patched to the full image.
+				strip->out[sof + 5] = (JOCTET)(cinfo->image_height >> 8);
+				strip->out[sof + 6] = (JOCTET)(cinfo->image_height & 0xFF);
+				emitBytes(cinfo, strip->out + 2, strip->out_len - 4);
+			} else {
+				JOCTET marker[] = { 0xFF, (JOCTET)(JPEG_RST0 + ((strip->row / interval - 1) & 7)) };
+				emitBytes(cinfo, marker, sizeof(marker));
+				emitBytes(cinfo, strip->out + scan, strip->out_len - scan - 2);
+			}
+
+			free(strip->out);
+			strip->out = NULL;
+		}
+	}
+
+	(*cinfo->marker->write_file_trailer)(cinfo);
+	(*cinfo->dest->term_destination)(cinfo);
+
+	return TRUE;
+}
+
+static void requantize(j_decompress_ptr srcinfo, j_compress_ptr cinfo, jvirt_barray_ptr* coef_arrays) {
+	for (int ci = 0; ci < cinfo->num_components; ci++) {
+		jpeg_component_info* srccomp = srcinfo->comp_info + ci;
+		jpeg_component_info* dstcomp = cinfo->comp_info + ci;
+		JQUANT_TBL* srcqt = srccomp->quant_table;
+		JQUANT_TBL* dstqt = cinfo->quant_tbl_ptrs[dstcomp->quant_tbl_no];
+		if (!srcqt || !dstqt)
+			ERREXIT1(cinfo, JERR_NO_QUANT_TABLE, dstcomp->quant_tbl_no);
+
+		// Quantized coefficients are rescaled to the new step size, rounding to nearest.  Identical steps are skipped.
+		int same = TRUE;
+		for (int k = 0; k < DCTSIZE2; k++)
+			same &= srcqt->quantval[k] == dstqt->quantval[k];
+
+		if (same)
+			continue;
+
+		for (JDIMENSION blk_y = 0; blk_y < srccomp->height_in_blocks; blk_y += srccomp->v_samp_factor) {
+			JDIMENSION rows = MIN((JDIMENSION)srccomp->v_samp_factor, srccomp->height_in_blocks - blk_y);
+			JBLOCKARRAY blocks = (*srcinfo->mem->access_virt_barray)((j_common_ptr)srcinfo, coef_arrays[ci], blk_y, rows, TRUE);
+
+			for (JDIMENSION y = 0; y < rows; y++) {
+				for (JDIMENSION x = 0; x < srccomp->width_in_blocks; x++) {
+					JCOEFPTR coef = blocks[y][x];
+					for (int k = 0; k < DCTSIZE2; k++) {
+						long val = (long)coef[k] * srcqt->quantval[k];
+						long div = dstqt->quantval[k];
+						coef[k] = (JCOEF)(val < 0 ? -((div / 2 - val) / div) : (val + div / 2) / div);
+					}
+				}
+			}
+		}
+	}
+}
+
+static void setProgressMonitor(j_decompress_ptr cinfo) {
+	if (cinfo->progressive_mode) {
+		void* prg = (*cinfo->mem->alloc_small)((j_common_ptr)cinfo, JPOOL_IMAGE, sizeof(struct jpeg_progress_mgr));
+		cinfo->progress = (struct jpeg_progress_mgr*)memset(prg, 0, sizeof(struct jpeg_progress_mgr));
+		cinfo->progress->progress_monitor = abortExcessiveProgressive;
+	}
+}
+
+static void startDecompress(j_decompress_ptr cinfo) {
+	setProgressMonitor(cinfo);
+	jpeg_start_decompress(cinfo);
+}
+
+// Rows/columns of coefficients read by the IDCT for a given output block size.  The reduced 2x2 and 4x4 kernels are
+// folded from the 8-point transform and skip only the even coefficients past their size; the others read the NxN corner.
+static int idctMask(int size) {
+	switch (size) {
+		case 1: return 0x01;
+		case 2: return 0xab;
+		case 4: return 0xef;
+		default: return size < DCTSIZE ? (1 << size) - 1 : 0xff;
+	}
+}
+
+// TRUE once every coefficient the IDCT reads at the current output scale has arrived at full precision.
+static boolean scaledScansComplete(j_decompress_ptr cinfo) {
+	jpeg_component_info* compptr = cinfo->comp_info;
+	for (int ci = 0; ci < cinfo->num_components; ci++, compptr++) {
+		if (!compptr->component_needed)
+			continue;
+
+		int mask = idctMask(compptr->DCT_scaled_size);
+		for (int k = 0; k < DCTSIZE2; k++) {
+			int pos = jpeg_natural_order[k];
+			if ((mask >> (pos / DCTSIZE) & mask >> (pos % DCTSIZE) & 1) && cinfo->coef_bits[ci][k] != 0)
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static void decodeScansUpTo(j_decompress_ptr cinfo, int max_scan) {
+	if (!cinfo->progressive_mode) {
+		startDecompress(cinfo);
+		return;
+	}
+
+	if (max_scan <= 0) {
+		jpeg_calc_output_dimensions(cinfo);
+
+		int mask = 0;
+		for (int ci = 0; ci < cinfo->num_components; ci++)
+			mask |= idctMask(cinfo->comp_info[ci].DCT_scaled_size);
+
+		// Full-size output needs every scan, so there is nothing to gain from buffered mode.
+		if (mask == 0xff) {
+			startDecompress(cinfo);
+			return;
+		}
+	}
+
+	// Smoothing looks ahead into the next scan, which would read past the limit.  At a reduced scale it would also
+	// only estimate coefficients the IDCT doesn't read.
+	cinfo->do_block_smoothing = FALSE;
+	cinfo->buffered_image = TRUE;
+	startDecompress(cinfo);
+
+	// Scans are absorbed into the coefficient buffer one at a time.  Stopping between scans leaves the remaining input
+	// unread, and coefficients that haven't arrived are zero.
+	for (;;) {
+		int ret = jpeg_consume_input(cinfo);
+		if (ret == JPEG_REACHED_EOI)
+			break;
+
+		if (ret == JPEG_SUSPENDED)
+			ERREXIT(cinfo, JERR_INPUT_EMPTY);
+
+		if (ret == JPEG_REACHED_SOS)
+			(*cinfo->progress->progress_monitor)((j_common_ptr)cinfo);
+
+		if (ret == JPEG_SCAN_COMPLETED && (max_scan > 0 ? cinfo->input_scan_number >= max_scan : scaledScansComplete(cinfo)))
+			break;
+	}
+
+	jpeg_start_output(cinfo, cinfo->input_scan_number);
+}
+
+static void finishDecompress(j_decompress_ptr cinfo) {
+	// jpeg_read_coefficients also sets buffered_image, but leaves no output pass to finish.
+	if (cinfo->buffered_image && cinfo->global_state != DSTATE_STOPPING) {
+		// A scan-limited decode has nothing left to finish, and jpeg_finish_decompress would read the remaining scans.
+		if (!cinfo->inputctl->eoi_reached) {
+			JpegAbortDecompress(cinfo);
+			return;
+		}
+
+		jpeg_finish_output(cinfo);
+	}
+
+	jpeg_finish_decompress(cinfo);
+}
+
 int JpegVersion() {
 	return LIBJPEG_TURBO_VERSION_NUMBER;
 }
 
 j_compress_ptr JpegCreateCompress() {
-	j_compress_ptr cinfo = (j_compress_ptr)malloc(sizeof(struct jpeg_compress_struct));
+	return JpegCreateCompressWithAllocator(NULL, 0);
+}
+
+j_compress_ptr JpegCreateCompressWithAllocator(const ps_allocator* allocator, size_t retain) {
+	j_compress_ptr volatile cinfo = (j_compress_ptr)malloc(sizeof(struct jpeg_compress_struct));
 	ps_client_data* pcd = (ps_client_data*)malloc(sizeof(ps_client_data));
 	ps_error_mgr* err = (ps_error_mgr*)_mm_malloc(sizeof(ps_error_mgr), JMP_BUF_ALIGN);
-	if (!cinfo || !pcd || !err) {
+	ps_arena* arena = allocator || retain ? createArena(allocator, retain) : NULL;
+	if (!cinfo || !pcd || !err || ((allocator || retain) && !arena)) {
+		destroyArena(arena);
 		_mm_free(err);
 		free(pcd);
 		free(cinfo);
@@ -202,6 +1488,7 @@ j_compress_ptr JpegCreateCompress() {
 
 	cinfo->err = setErr(err);
 	cinfo->client_data = memset(pcd, 0, sizeof(ps_client_data));
+	pcd->arena = arena;
 
 	TRY {
 		jpeg_create_compress(cinfo);
@@ -214,10 +1501,16 @@ j_compress_ptr JpegCreateCompress() {
 }
 
 j_decompress_ptr JpegCreateDecompress() {
-	j_decompress_ptr cinfo = (j_decompress_ptr)malloc(sizeof(struct jpeg_decompress_struct));
+	return JpegCreateDecompressWithAllocator(NULL, 0);
+}
+
+j_decompress_ptr JpegCreateDecompressWithAllocator(const ps_allocator* allocator, size_t retain) {
+	j_decompress_ptr volatile cinfo = (j_decompress_ptr)malloc(sizeof(struct jpeg_decompress_struct));
 	ps_client_data* pcd = (ps_client_data*)malloc(sizeof(ps_client_data));
 	ps_error_mgr* err = (ps_error_mgr*)_mm_malloc(sizeof(ps_error_mgr), JMP_BUF_ALIGN);
-	if (!cinfo || !pcd || !err) {
+	ps_arena* arena = allocator || retain ? createArena(allocator, retain) : NULL;
+	if (!cinfo || !pcd || !err || ((allocator || retain) && !arena)) {
+		destroyArena(arena);
 		_mm_free(err);
 		free(pcd);
 		free(cinfo);
@@ -226,6 +1519,7 @@ j_decompress_ptr JpegCreateDecompress() {
 
 	cinfo->err = setErr(err);
 	cinfo->client_data = memset(pcd, 0, sizeof(ps_client_data));
+	pcd->arena = arena;
 
 	TRY {
 		jpeg_create_decompress(cinfo);
@@ -238,16 +1532,52 @@ j_decompress_ptr JpegCreateDecompress() {
 }
 
 void JpegDestroy(j_common_ptr cinfo) {
-	free(cinfo->client_data);
-	_mm_free(cinfo->err);
+	ps_client_data* pcd = (ps_client_data*)cinfo->client_data;
+
+	if (!cinfo->is_decompressor && ((j_compress_ptr)cinfo)->dest)
+		free(((ps_dest_mgr*)((j_compress_ptr)cinfo)->dest)->mem);
+	else if (cinfo->is_decompressor && ((j_decompress_ptr)cinfo)->src) {
+		free(((ps_src_mgr*)((j_decompress_ptr)cinfo)->src)->rst_offs);
+		free(((ps_src_mgr*)((j_decompress_ptr)cinfo)->src)->buff_heap);
+	}
+
+	// The memory manager releases its pools through the arena, so it must go first.
 	jpeg_destroy(cinfo);
+	if (pcd)
+		destroyArena(pcd->arena);
+
+	free(pcd);
+	_mm_free(cinfo->err);
 
 	memset(cinfo, 0, sizeof(struct jpeg_common_struct));
 	free(cinfo);
 }
 
 void JpegAbortDecompress(j_decompress_ptr cinfo) {
+	countMemSource(cinfo);
 	jpeg_abort_decompress(cinfo);
+	cinfo->progress = NULL;
+}
+
+int JpegResetCompress(j_compress_ptr cinfo) {
+	TRY {
+		jpeg_abort_compress(cinfo);
+		restoreHuffTables(cinfo);
+		resetDest((ps_dest_mgr*)cinfo->dest, FALSE);
+		resetErr((ps_error_mgr*)cinfo->err);
+	}
+	return TRY_RESULT;
+}
+
+int JpegResetDecompress(j_decompress_ptr cinfo) {
+	TRY {
+		countMemSource(cinfo);
+		jpeg_abort_decompress(cinfo);
+		cinfo->progress = NULL;
+		resetSource((ps_src_mgr*)cinfo->src, NULL, 0);
+		resetErr((ps_error_mgr*)cinfo->err);
+	}
+	return TRY_RESULT;
 }
 
 void JpegFree(void* mem) {
@@ -258,6 +1588,81 @@ const char* JpegGetLastError(j_common_ptr cinfo) {
 	return ((ps_error_mgr*)cinfo->err)->msg;
 }
 
+void JpegGetStats(j_common_ptr cinfo, ps_jpeg_stats* stats) {
+	if (cinfo->is_decompressor)
+		countMemSource((j_decompress_ptr)cinfo);
+
+	*stats = *getStats(cinfo);
+}
+
+void JpegResetStats(j_common_ptr cinfo) {
+	memset(getStats(cinfo), 0, sizeof(ps_jpeg_stats));
+}
+
+int JpegSetBufferSize(j_common_ptr cinfo, size_t size) {
+	TRY {
+		if (size < MIN_BUF_SIZE)
+			ERREXIT(cinfo, JERR_BUFFER_SIZE);
+
+		if (cinfo->is_decompressor) {
+			ps_src_mgr* src = (ps_src_mgr*)((j_decompress_ptr)cinfo)->src;
+			if (cinfo->global_state != DSTATE_START)
+				ERREXIT1(cinfo, JERR_BAD_STATE, cinfo->global_state);
+
+			// Pool memory lives as long as the handle, so a larger buffer is kept on the heap and grown in place.
+			if (size > src->buff_alloc) {
+				JOCTET* buff = (JOCTET*)realloc(src->buff_heap, size * sizeof(JOCTET));
+				if (!buff)
+					ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 10);
+
+				src->buff = src->buff_heap = buff;
+				src->buff_alloc = size;
+			}
+
+			src->buff_size = size;
+		} else {
+			ps_dest_mgr* dest = (ps_dest_mgr*)((j_compress_ptr)cinfo)->dest;
+			if (cinfo->global_state != CSTATE_START)
+				ERREXIT1(cinfo, JERR_BAD_STATE, cinfo->global_state);
+
+			dest->buff_size = size;
+		}
+	}
+	return TRY_RESULT;
+}
+
+int JpegSetMemorySource(j_decompress_ptr cinfo, const JOCTET* buff, size_t len) {
+	const JOCTET* volatile mem = buff;
+	volatile size_t mem_len = len;
+
+	TRY {
+		ps_src_mgr* src = (ps_src_mgr*)cinfo->src;
+		if (cinfo->global_state != DSTATE_START)
+			ERREXIT1(cinfo, JERR_BAD_STATE, cinfo->global_state);
+
+		resetSource(src, mem, mem_len);
+	}
+	return TRY_RESULT;
+}
+
+int JpegSetMemoryDest(j_compress_ptr cinfo) {
+	TRY {
+		ps_dest_mgr* dest = (ps_dest_mgr*)cinfo->dest;
+		if (cinfo->global_state != CSTATE_START)
+			ERREXIT1(cinfo, JERR_BAD_STATE, cinfo->global_state);
+
+		resetDest(dest, TRUE);
+	}
+	return TRY_RESULT;
+}
+
+void JpegGetMemoryDest(j_compress_ptr cinfo, const JOCTET** buff, size_t* len) {
+	ps_dest_mgr* dest = (ps_dest_mgr*)cinfo->dest;
+
+	*buff = dest->mem;
+	*len = dest->mem_len;
+}
+
 int JpegSetDefaults(j_compress_ptr cinfo) {
 	TRY jpeg_set_defaults(cinfo);
 	return TRY_RESULT;
@@ -274,43 +1679,82 @@ int JpegSimpleProgression(j_compress_ptr cinfo) {
 }
 
 int JpegStartCompress(j_compress_ptr cinfo) {
-	TRY jpeg_start_compress(cinfo, TRUE);
+	uint64_t start = ticks();
+	TRY {
+		saveHuffTables(cinfo);
+		jpeg_start_compress(cinfo, TRUE);
+	}
+	endStage((j_common_ptr)cinfo, PS_JPEG_STAGE_START, start, 0);
 	return TRY_RESULT;
 }
 
 int JpegWriteScanlines(j_compress_ptr cinfo, JSAMPARRAY scanlines, JDIMENSION num_lines, JDIMENSION* lines_written) {
+	uint64_t start = ticks();
 	TRY
 		*lines_written = jpeg_write_scanlines(cinfo, scanlines, num_lines);
 	CATCH
 		*lines_written = 0;
+	endStage((j_common_ptr)cinfo, PS_JPEG_STAGE_PIXELS, start, *lines_written);
 	return TRY_RESULT;
 }
 
 int JpegWriteRawData(j_compress_ptr cinfo, JSAMPIMAGE data, JDIMENSION num_lines, JDIMENSION* lines_written) {
+	uint64_t start = ticks();
 	TRY
 		*lines_written = jpeg_write_raw_data(cinfo, data, num_lines);
 	CATCH
 		*lines_written = 0;
+	endStage((j_common_ptr)cinfo, PS_JPEG_STAGE_PIXELS, start, *lines_written);
 	return TRY_RESULT;
 }
 
 int JpegFinishCompress(j_compress_ptr cinfo) {
+	uint64_t start = ticks();
 	TRY jpeg_finish_compress(cinfo);
+	endStage((j_common_ptr)cinfo, PS_JPEG_STAGE_FINISH, start, 0);
+	return TRY_RESULT;
+}
+
+int JpegWriteImageParallel(j_compress_ptr cinfo, JSAMPARRAY scanlines, JSAMPIMAGE planes, int threads) {
+	ps_strip_list list = { NULL, 0 };
+	uint64_t start = ticks();
+
+	TRY {
+		if ((cinfo->global_state != CSTATE_SCANNING && cinfo->global_state != CSTATE_RAW_OK) || cinfo->next_scanline)
+			ERREXIT1(cinfo, JERR_BAD_STATE, cinfo->global_state);
+
+		if (encodeParallel(cinfo, scanlines, planes, threads, &list)) {
+			jpeg_abort((j_common_ptr)cinfo);
+		} else {
+			writeRows(cinfo, scanlines, planes, 0, cinfo->raw_data_in ? cinfo->total_iMCU_rows : cinfo->image_height);
+			jpeg_finish_compress(cinfo);
+		}
+	} CATCH {
+		for (int i = 0; i < list.count; i++)
+			free(list.strips[i].out);
+	}
+	endStage((j_common_ptr)cinfo, PS_JPEG_STAGE_PIXELS, start, _jmp_res ? 0 : cinfo->image_height);
 	return TRY_RESULT;
 }
 
 int JpegWriteMarker(j_compress_ptr cinfo, int marker, const JOCTET* dataptr, unsigned int datalen) {
+	uint64_t start = ticks();
 	TRY jpeg_write_marker(cinfo, marker, dataptr, datalen);
+	endStage((j_common_ptr)cinfo, PS_JPEG_STAGE_HEADER, start, 0);
 	return TRY_RESULT;
 }
 
 int JpegWriteIccProfile(j_compress_ptr cinfo, const JOCTET* icc_data_ptr, unsigned int icc_data_len) {
+	uint64_t start = ticks();
 	TRY jpeg_write_icc_profile(cinfo, icc_data_ptr, icc_data_len);
+	endStage((j_common_ptr)cinfo, PS_JPEG_STAGE_HEADER, start, 0);
 	return TRY_RESULT;
 }
 
 int JpegReadHeader(j_decompress_ptr cinfo) {
+	uint64_t start = ticks();
 	TRY jpeg_read_header(cinfo, TRUE);
+	endStage((j_common_ptr)cinfo, PS_JPEG_STAGE_HEADER, start, 0);
 	return TRY_RESULT;
 }
 
@@ -320,14 +1764,9 @@ int JpegCalcOutputDimensions(j_decompress_ptr cinfo) {
 }
 
 int JpegStartDecompress(j_decompress_ptr cinfo) {
-	TRY {
-		if (cinfo->progressive_mode) {
-			void* prg = (*cinfo->mem->alloc_small)((j_common_ptr)cinfo, JPOOL_IMAGE, sizeof(struct jpeg_progress_mgr));
-			cinfo->progress = (struct jpeg_progress_mgr*)memset(prg, 0, sizeof(struct jpeg_progress_mgr));
-			cinfo->progress->progress_monitor = abortExcessiveProgressive;
-		}
-		jpeg_start_decompress(cinfo);
-	}
+	uint64_t start = ticks();
+	TRY startDecompress(cinfo);
+	endStage((j_common_ptr)cinfo, PS_JPEG_STAGE_START, start, 0);
 	return TRY_RESULT;
 }
 
@@ -337,31 +1776,186 @@ int JpegCropScanline(j_decompress_ptr cinfo, JDIMENSION* xoffset, JDIMENSION* wi
 }
 
 int JpegReadScanlines(j_decompress_ptr cinfo, JSAMPARRAY scanlines, JDIMENSION max_lines, JDIMENSION* lines_read) {
+	uint64_t start = ticks();
 	TRY
 		*lines_read = jpeg_read_scanlines(cinfo, scanlines, max_lines);
 	CATCH
 		*lines_read = 0;
+	endStage((j_common_ptr)cinfo, PS_JPEG_STAGE_PIXELS, start, *lines_read);
 	return TRY_RESULT;
 }
 
 int JpegReadRawData(j_decompress_ptr cinfo, JSAMPIMAGE data, JDIMENSION max_lines, JDIMENSION* lines_read) {
+	uint64_t start = ticks();
 	TRY
 		*lines_read = jpeg_read_raw_data(cinfo, data, max_lines);
 	CATCH
 		*lines_read = 0;
+	endStage((j_common_ptr)cinfo, PS_JPEG_STAGE_PIXELS, start, *lines_read);
 	return TRY_RESULT;
 }
 
 int JpegSkipScanlines(j_decompress_ptr cinfo, JDIMENSION num_lines, JDIMENSION* lines_skipped) {
+	uint64_t start = ticks();
 	TRY
 		*lines_skipped = jpeg_skip_scanlines(cinfo, num_lines);
 	CATCH
 		*lines_skipped = 0;
+	endStage((j_common_ptr)cinfo, PS_JPEG_STAGE_PIXELS, start, *lines_skipped);
 	return TRY_RESULT;
 }
 
 int JpegFinishDecompress(j_decompress_ptr cinfo) {
-	TRY jpeg_finish_decompress(cinfo);
+	uint64_t start = ticks();
+	TRY finishDecompress(cinfo);
+	endStage((j_common_ptr)cinfo, PS_JPEG_STAGE_FINISH, start, 0);
+	return TRY_RESULT;
+}
+
+int JpegDecodeScansUpTo(j_decompress_ptr cinfo, int max_scan) {
+	uint64_t start = ticks();
+	TRY decodeScansUpTo(cinfo, max_scan);
+	endStage((j_common_ptr)cinfo, PS_JPEG_STAGE_START, start, 0);
+	return TRY_RESULT;
+}
+
+int JpegGetRestartIndex(j_decompress_ptr cinfo, const size_t** offsets, JDIMENSION* count) {
+	TRY {
+		ps_src_mgr* src = (ps_src_mgr*)cinfo->src;
+		if (!src->indexed && src->mem) {
+			if (cinfo->global_state != DSTATE_READY)
+				ERREXIT1(cinfo, JERR_BAD_STATE, cinfo->global_state);
+
+			indexRestarts(cinfo);
+		}
+
+		*offsets = src->rst_offs;
+		*count = src->rst_count;
+	}
+	return TRY_RESULT;
+}
+
+int JpegDecodeBandsParallel(j_decompress_ptr cinfo, JSAMPARRAY scanlines, JSAMPIMAGE planes, int threads) {
+	uint64_t start = ticks();
+	TRY {
+		if (cinfo->global_state != DSTATE_READY)
+			ERREXIT1(cinfo, JERR_BAD_STATE, cinfo->global_state);
+
+		jpeg_calc_output_dimensions(cinfo);
+		if (decodeParallel(cinfo, scanlines, planes, threads)) {
+			countMemSource(cinfo);
+			jpeg_abort_decompress(cinfo);
+		} else {
+			startDecompress(cinfo);
+			readRows(cinfo, scanlines, planes, 0, cinfo->raw_data_out ? cinfo->total_iMCU_rows : cinfo->output_height);
+			jpeg_finish_decompress(cinfo);
+		}
+	}
+	endStage((j_common_ptr)cinfo, PS_JPEG_STAGE_PIXELS, start, _jmp_res ? 0 : cinfo->output_height);
+	return TRY_RESULT;
+}
+
+int JpegReadCoefficients(j_decompress_ptr cinfo, jvirt_barray_ptr** coef_arrays) {
+	uint64_t start = ticks();
+	TRY {
+		setProgressMonitor(cinfo);
+		*coef_arrays = jpeg_read_coefficients(cinfo);
+	} CATCH
+		*coef_arrays = NULL;
+	endStage((j_common_ptr)cinfo, PS_JPEG_STAGE_COEFFICIENTS, start, 0);
+	return TRY_RESULT;
+}
+
+int JpegAccessCoefficients(j_common_ptr cinfo, jvirt_barray_ptr coef_array, JDIMENSION start_row, JDIMENSION num_rows, int writable, JBLOCKARRAY* blocks) {
+	TRY
+		*blocks = (*cinfo->mem->access_virt_barray)(cinfo, coef_array, start_row, num_rows, writable);
+	CATCH
+		*blocks = NULL;
+	return TRY_RESULT;
+}
+
+int JpegCopyCriticalParameters(j_decompress_ptr srcinfo, j_compress_ptr cinfo) {
+	TRY {
+		CHAIN(srcinfo);
+		jpeg_copy_critical_parameters(srcinfo, cinfo);
+	}
+	return TRY_RESULT;
+}
+
+int JpegRequantize(j_decompress_ptr srcinfo, j_compress_ptr cinfo, jvirt_barray_ptr* coef_arrays) {
+	uint64_t start = ticks();
+	TRY {
+		CHAIN(srcinfo);
+		if (srcinfo->global_state != DSTATE_STOPPING)
+			ERREXIT1(srcinfo, JERR_BAD_STATE, srcinfo->global_state);
+		if (cinfo->global_state != CSTATE_START)
+			ERREXIT1(cinfo, JERR_BAD_STATE, cinfo->global_state);
+
+		requantize(srcinfo, cinfo, coef_arrays);
+	}
+	endStage((j_common_ptr)cinfo, PS_JPEG_STAGE_COEFFICIENTS, start, 0);
+	return TRY_RESULT;
+}
+
+int JpegWriteCoefficients(j_compress_ptr cinfo, jvirt_barray_ptr* coef_arrays) {
+	uint64_t start = ticks();
+	TRY {
+		saveHuffTables(cinfo);
+		jpeg_write_coefficients(cinfo, coef_arrays);
+	}
+	endStage((j_common_ptr)cinfo, PS_JPEG_STAGE_COEFFICIENTS, start, 0);
+	return TRY_RESULT;
+}
+
+int JpegTransform(j_decompress_ptr srcinfo, j_compress_ptr cinfo, int transform, JDIMENSION crop_x, JDIMENSION crop_y, JDIMENSION crop_width, JDIMENSION crop_height, int flags) {
+	uint64_t start = ticks();
+	TRY {
+		CHAIN(srcinfo);
+		if (srcinfo->global_state != DSTATE_READY)
+			ERREXIT1(srcinfo, JERR_BAD_STATE, srcinfo->global_state);
+		if (transform < JXFORM_NONE || transform > JXFORM_ROT_270) {
+			SNPRINTF(((ps_error_mgr*)cinfo->err)->msg, JMSG_LENGTH_MAX, "Unsupported transform code %d.", transform);
+			LONGJMP(((ps_error_mgr*)cinfo->err)->jmp_buf, 1);
+		}
+
+		jpeg_transform_info info;
+		memset(&info, 0, sizeof(info));
+		info.transform = (JXFORM_CODE)transform;
+		info.trim = (flags & PS_TRANSFORM_TRIM) != 0;
+		info.perfect = (flags & PS_TRANSFORM_PERFECT) != 0;
+
+		if (crop_width && crop_height) {
+			info.crop = TRUE;
+			info.crop_xoffset = crop_x;
+			info.crop_yoffset = crop_y;
+			info.crop_width = crop_width;
+			info.crop_height = crop_height;
+			info.crop_xoffset_set = info.crop_yoffset_set = JCROP_POS;
+			info.crop_width_set = info.crop_height_set = JCROP_POS;
+		}
+
+		if (!jtransform_request_workspace(srcinfo, &info)) {
+			SNPRINTF(((ps_error_mgr*)cinfo->err)->msg, JMSG_LENGTH_MAX, "Transform requires trimming partial MCUs, and PS_TRANSFORM_PERFECT was requested.");
+			LONGJMP(((ps_error_mgr*)cinfo->err)->jmp_buf, 1);
+		}
+
+		setProgressMonitor(srcinfo);
+		jvirt_barray_ptr* src_coefs = jpeg_read_coefficients(srcinfo);
+		jpeg_copy_critical_parameters(srcinfo, cinfo);
+		jvirt_barray_ptr* dst_coefs = jtransform_adjust_parameters(srcinfo, cinfo, src_coefs, &info);
+
+		cinfo->optimize_coding = (flags & PS_TRANSFORM_OPTIMIZE) != 0;
+		if (flags & PS_TRANSFORM_PROGRESSIVE)
+			jpeg_simple_progression(cinfo);
+
+		saveHuffTables(cinfo);
+		jpeg_write_coefficients(cinfo, dst_coefs);
+		if (flags & PS_TRANSFORM_COPY_MARKERS)
+			jcopy_markers_execute(srcinfo, cinfo, JCOPYOPT_ALL);
+
+		jtransform_execute_transform(srcinfo, cinfo, src_coefs, &info);
+	}
+	endStage((j_common_ptr)cinfo, PS_JPEG_STAGE_COEFFICIENTS, start, 0);
 	return TRY_RESULT;
 }
 
@@ -5,13 +5,57 @@
 #include <stdint.h>
 #include "jpeglib.h"
 
+#ifndef PS_ALLOCATOR_DEFINED
+#define PS_ALLOCATOR_DEFINED
+typedef struct {
+	void* state;
+	void*(*alloc)(void* state, size_t size);
+	void(*free)(void* state, void* mem);
+} ps_allocator;
+#endif
+
+typedef struct ps_arena ps_arena;
+
+// JpegGetStats stages.  Each exported call is charged to one of these, including any time it spends in callbacks.
+#define PS_JPEG_STAGE_HEADER 0       // header reads and marker writes
+#define PS_JPEG_STAGE_START 1        // compress/decompress startup, including buffered progressive input
+#define PS_JPEG_STAGE_PIXELS 2       // scanline, raw data and parallel reads and writes
+#define PS_JPEG_STAGE_COEFFICIENTS 3 // coefficient reads and writes, requantize and transform
+#define PS_JPEG_STAGE_FINISH 4       // compress/decompress completion
+#define PS_JPEG_STAGE_COUNT 5
+
+// Per-handle counters, accumulated until JpegResetStats.  Times are in nanoseconds.  Memory sources count the bytes
+// the decoder has consumed, and memory destinations the bytes written, with no callbacks.
+typedef struct {
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	uint64_t read_calls;
+	uint64_t write_calls;
+	uint64_t seek_calls;
+	uint64_t callback_ns;
+	uint64_t rows;
+	uint64_t stage_ns[PS_JPEG_STAGE_COUNT];
+} ps_jpeg_stats;
+
 typedef struct {
 	intptr_t stream_handle;
 	size_t(*write_callback)(intptr_t pinst, JOCTET* buff, size_t cb);
 	size_t(*read_callback)(intptr_t pinst, JOCTET* buff, size_t cb);
 	size_t(*seek_callback)(intptr_t pinst, size_t cb);
+	ps_arena* arena;
+	ps_jpeg_stats stats;
 } ps_client_data;
 
+// JpegDecodeScansUpTo max_scan value that stops once the coefficients needed for the output scale are complete.
+#define PS_SCANS_FOR_SCALE 0
+
+// JpegTransform flags.  Transform codes are the JXFORM_CODE values from transupp.h (JXFORM_NONE through JXFORM_ROT_270).
+#define PS_TRANSFORM_TRIM 0x01         // drop partial edge MCUs that cannot be transformed losslessly
+#define PS_TRANSFORM_PERFECT 0x02      // fail rather than leave partial edge MCUs untransformed
+#define PS_TRANSFORM_OPTIMIZE 0x04     // compute optimal Huffman tables for the output
+#define PS_TRANSFORM_PROGRESSIVE 0x08  // write the output with the default progressive script
+#define PS_TRANSFORM_COPY_MARKERS 0x10 // copy markers saved with JpegSaveMarkers to the output
+
 #if defined(__GNUC__) && defined(DLLDEFINE)
 #define DLLEXPORT __attribute__((__visibility__("default")))
 #elif defined(_MSC_VER) && defined(DLLDEFINE)
@@ -30,12 +74,23 @@ DLLEXPORT int JpegVersion();
 
 DLLEXPORT j_compress_ptr JpegCreateCompress();
 DLLEXPORT j_decompress_ptr JpegCreateDecompress();
+DLLEXPORT j_compress_ptr JpegCreateCompressWithAllocator(const ps_allocator* allocator, size_t retain);
+DLLEXPORT j_decompress_ptr JpegCreateDecompressWithAllocator(const ps_allocator* allocator, size_t retain);
 
 DLLEXPORT void JpegDestroy(j_common_ptr cinfo);
 DLLEXPORT void JpegAbortDecompress(j_decompress_ptr cinfo);
+DLLEXPORT int JpegResetCompress(j_compress_ptr cinfo);
+DLLEXPORT int JpegResetDecompress(j_decompress_ptr cinfo);
 
 DLLEXPORT void JpegFree(void* mem);
 DLLEXPORT const char* JpegGetLastError(j_common_ptr cinfo);
+DLLEXPORT void JpegGetStats(j_common_ptr cinfo, ps_jpeg_stats* stats);
+DLLEXPORT void JpegResetStats(j_common_ptr cinfo);
+
+DLLEXPORT int JpegSetBufferSize(j_common_ptr cinfo, size_t size);
+DLLEXPORT int JpegSetMemorySource(j_decompress_ptr cinfo, const JOCTET* buff, size_t len);
+DLLEXPORT int JpegSetMemoryDest(j_compress_ptr cinfo);
+DLLEXPORT void JpegGetMemoryDest(j_compress_ptr cinfo, const JOCTET** buff, size_t* len);
 
 DLLEXPORT int JpegSetDefaults(j_compress_ptr cinfo);
 DLLEXPORT int JpegSetQuality(j_compress_ptr cinfo, int quality);
@@ -45,6 +100,7 @@ DLLEXPORT int JpegStartCompress(j_compress_ptr cinfo);
 DLLEXPORT int JpegWriteScanlines(j_compress_ptr cinfo, JSAMPARRAY scanlines, JDIMENSION num_lines, JDIMENSION* lines_written);
 DLLEXPORT int JpegWriteRawData(j_compress_ptr cinfo, JSAMPIMAGE data, JDIMENSION num_lines, JDIMENSION* lines_written);
 DLLEXPORT int JpegFinishCompress(j_compress_ptr cinfo);
+DLLEXPORT int JpegWriteImageParallel(j_compress_ptr cinfo, JSAMPARRAY scanlines, JSAMPIMAGE planes, int threads);
 
 DLLEXPORT int JpegWriteMarker(j_compress_ptr cinfo, int marker, const JOCTET* dataptr, unsigned int datalen);
 DLLEXPORT int JpegWriteIccProfile(j_compress_ptr cinfo, const JOCTET* icc_data_ptr, unsigned int icc_data_len);
@@ -58,6 +114,17 @@ DLLEXPORT int JpegReadScanlines(j_decompress_ptr cinfo, JSAMPARRAY scanlines, JD
 DLLEXPORT int JpegReadRawData(j_decompress_ptr cinfo, JSAMPIMAGE data, JDIMENSION max_lines, JDIMENSION* lines_read);
 DLLEXPORT int JpegSkipScanlines(j_decompress_ptr cinfo, JDIMENSION num_lines, JDIMENSION* lines_skipped);
 DLLEXPORT int JpegFinishDecompress(j_decompress_ptr cinfo);
+DLLEXPORT int JpegDecodeScansUpTo(j_decompress_ptr cinfo, int max_scan);
+
+DLLEXPORT int JpegGetRestartIndex(j_decompress_ptr cinfo, const size_t** offsets, JDIMENSION* count);
+DLLEXPORT int JpegDecodeBandsParallel(j_decompress_ptr cinfo, JSAMPARRAY scanlines, JSAMPIMAGE planes, int threads);
+
+DLLEXPORT int JpegReadCoefficients(j_decompress_ptr cinfo, jvirt_barray_ptr** coef_arrays);
+DLLEXPORT int JpegAccessCoefficients(j_common_ptr cinfo, jvirt_barray_ptr coef_array, JDIMENSION start_row, JDIMENSION num_rows, int writable, JBLOCKARRAY* blocks);
+DLLEXPORT int JpegCopyCriticalParameters(j_decompress_ptr srcinfo, j_compress_ptr cinfo);
+DLLEXPORT int JpegRequantize(j_decompress_ptr srcinfo, j_compress_ptr cinfo, jvirt_barray_ptr* coef_arrays);
+DLLEXPORT int JpegWriteCoefficients(j_compress_ptr cinfo, jvirt_barray_ptr* coef_arrays);
+DLLEXPORT int JpegTransform(j_decompress_ptr srcinfo, j_compress_ptr cinfo, int transform, JDIMENSION crop_x, JDIMENSION crop_y, JDIMENSION crop_width, JDIMENSION crop_height, int flags);
 
 DLLEXPORT int JpegSaveMarkers(j_decompress_ptr cinfo, int marker_code, unsigned int length_limit);
 DLLEXPORT int JpegReadIccProfile(j_decompress_ptr cinfo, JOCTET** icc_data_ptr, unsigned int* icc_data_len);
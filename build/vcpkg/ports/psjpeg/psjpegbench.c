@@ -0,0 +1,374 @@
+// Copyright © Clinton Ingram and Contributors.  Licensed under the MIT License.
+
+// Benchmarks for psjpeg, in two sections:
+//
+// corpus: Encodes and decodes a fixed corpus of synthetic images covering several sizes, chroma subsamplings and
+// baseline/progressive scans through stream callbacks, as the managed wrapper does, and reports the best time for
+// each along with the JpegGetStats breakdown of that run.  Encodes are timed single-threaded and with the requested
+// thread count (parallel restart-marker strips; progressive falls back to single-threaded).  Only 8-bit samples
+// are covered, since that is the only precision psjpeg is built for.
+//
+// restart: Compresses one synthetic 4:2:0 image at several quality levels, single-threaded without restart markers
+// and in parallel restart-marker strips, and reports throughput along with the size overhead of the markers.
+// A restart marker on every MCU row is included as a worst case.
+//
+// With no arguments, both sections run with their defaults.
+//
+// usage: psjpegbench corpus [threads] [iterations] [quality]
+//        psjpegbench restart [width] [height] [threads] [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+#include "psjpeg.h"
+
+typedef struct {
+	JDIMENSION width;
+	JDIMENSION height;
+} bench_size;
+
+typedef struct {
+	const char* name;
+	int components;
+	int h_samp;
+	int v_samp;
+} bench_sampling;
+
+typedef struct {
+	JOCTET* data;
+	size_t size;
+	size_t len;
+	size_t pos;
+} bench_stream;
+
+static const bench_size sizes[] = { { 640, 480 }, { 1920, 1080 }, { 6000, 4000 } };
+static const bench_sampling samplings[] = { { "4:4:4", 3, 1, 1 }, { "4:2:2", 3, 2, 1 }, { "4:2:0", 3, 2, 2 }, { "gray", 1, 1, 1 } };
+static const int qualities[] = { 50, 75, 85, 95 };
+
+static double now() {
+#ifdef _WIN32
+	LARGE_INTEGER freq, count;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+static double ms(uint64_t ns) {
+	return (double)ns * 1e-6;
+}
+
+// Smooth gradients with low-amplitude noise, so the entropy coder sees something closer to a photo than to flat color.
+static JSAMPLE* makeImage(JDIMENSION width, JDIMENSION height, int components) {
+	size_t stride = (size_t)width * components;
+	JSAMPLE* pixels = (JSAMPLE*)malloc(stride * height);
+	if (!pixels)
+		return NULL;
+
+	uint32_t seed = 0x2545f491;
+	for (JDIMENSION y = 0; y < height; y++) {
+		JSAMPLE* row = pixels + stride * y;
+		for (JDIMENSION x = 0; x < width; x++) {
+			for (int c = 0; c < components; c++) {
+				seed ^= seed << 13;
+				seed ^= seed >> 17;
+				seed ^= seed << 5;
+
+				int v = (int)((x * (c + 1) + y * (components - c)) * 255 / (width + height)) + (int)(seed & 7) - 4;
+				row[x * components + c] = (JSAMPLE)(v < 0 ? 0 : v > 255 ? 255 : v);
+			}
+		}
+	}
+
+	return pixels;
+}
+
+static unsigned countMarkers(const JOCTET* buff, size_t len) {
+	unsigned count = 0;
+	for (size_t i = 0; i + 1 < len; i++)
+		count += buff[i] == 0xFF && buff[i + 1] >= JPEG_RST0 && buff[i + 1] <= JPEG_RST0 + 7;
+
+	return count;
+}
+
+static size_t writeStream(intptr_t pinst, JOCTET* buff, size_t cb) {
+	bench_stream* stream = (bench_stream*)pinst;
+
+	if (stream->len + cb > stream->size) {
+		size_t size = (stream->len + cb) * 2;
+		JOCTET* data = (JOCTET*)realloc(stream->data, size);
+		if (!data)
+			return 0;
+
+		stream->data = data;
+		stream->size = size;
+	}
+
+	memcpy(stream->data + stream->len, buff, cb);
+	stream->len += cb;
+
+	return cb;
+}
+
+static size_t readStream(intptr_t pinst, JOCTET* buff, size_t cb) {
+	bench_stream* stream = (bench_stream*)pinst;
+
+	if (cb > stream->len - stream->pos)
+		cb = stream->len - stream->pos;
+
+	memcpy(buff, stream->data + stream->pos, cb);
+	stream->pos += cb;
+
+	return cb;
+}
+
+static size_t seekStream(intptr_t pinst, size_t cb) {
+	bench_stream* stream = (bench_stream*)pinst;
+
+	if (cb > stream->len - stream->pos)
+		cb = stream->len - stream->pos;
+
+	stream->pos += cb;
+
+	return cb;
+}
+
+static int encode(JSAMPARRAY rows, const bench_size* size, const bench_sampling* samp, int progressive, int restart_rows, int quality, int threads, bench_stream* out, ps_jpeg_stats* stats) {
+	j_compress_ptr cinfo = JpegCreateCompress();
+	if (!cinfo)
+		return FALSE;
+
+	ps_client_data* client = (ps_client_data*)cinfo->client_data;
+	client->stream_handle = (intptr_t)out;
+	client->write_callback = writeStream;
+	out->len = 0;
+
+	cinfo->image_width = size->width;
+	cinfo->image_height = size->height;
+	cinfo->input_components = samp->components;
+	cinfo->in_color_space = samp->components == 1 ? JCS_GRAYSCALE : JCS_RGB;
+
+	int ok = JpegSetDefaults(cinfo) && JpegSetQuality(cinfo, quality);
+	if (ok) {
+		cinfo->comp_info[0].h_samp_factor = samp->h_samp;
+		cinfo->comp_info[0].v_samp_factor = samp->v_samp;
+		cinfo->restart_in_rows = restart_rows;
+		if (progressive)
+			ok = JpegSimpleProgression(cinfo);
+	}
+
+	ok = ok && JpegStartCompress(cinfo) && JpegWriteImageParallel(cinfo, rows, NULL, threads);
+	if (!ok)
+		fprintf(stderr, "encode failed: %s\n", JpegGetLastError((j_common_ptr)cinfo));
+
+	JpegGetStats((j_common_ptr)cinfo, stats);
+	JpegDestroy((j_common_ptr)cinfo);
+	return ok;
+}
+
+static int decode(JSAMPARRAY rows, bench_stream* in, ps_jpeg_stats* stats) {
+	j_decompress_ptr cinfo = JpegCreateDecompress();
+	if (!cinfo)
+		return FALSE;
+
+	ps_client_data* client = (ps_client_data*)cinfo->client_data;
+	client->stream_handle = (intptr_t)in;
+	client->read_callback = readStream;
+	client->seek_callback = seekStream;
+	in->pos = 0;
+
+	int ok = JpegReadHeader(cinfo) && JpegStartDecompress(cinfo);
+	while (ok && cinfo->output_scanline < cinfo->output_height) {
+		JDIMENSION lines;
+		ok = JpegReadScanlines(cinfo, rows + cinfo->output_scanline, cinfo->output_height - cinfo->output_scanline, &lines);
+	}
+
+	ok = ok && JpegFinishDecompress(cinfo);
+	if (!ok)
+		fprintf(stderr, "decode failed: %s\n", JpegGetLastError((j_common_ptr)cinfo));
+
+	JpegGetStats((j_common_ptr)cinfo, stats);
+	JpegDestroy((j_common_ptr)cinfo);
+	return ok;
+}
+
+// Keeps the stats from the fastest run, so the breakdown matches the reported time.
+static void keepBest(int i, double start, double* secs, ps_jpeg_stats* best, const ps_jpeg_stats* stats) {
+	double elapsed = now() - start;
+	if (i == 0 || elapsed < *secs) {
+		*secs = elapsed;
+		*best = *stats;
+	}
+}
+
+static int benchEncode(JSAMPARRAY rows, const bench_size* size, const bench_sampling* samp, int progressive, int restart_rows, int quality, int threads, int iterations, bench_stream* out, double* secs, ps_jpeg_stats* best) {
+	for (int i = 0; i < iterations; i++) {
+		ps_jpeg_stats stats;
+		double start = now();
+		if (!encode(rows, size, samp, progressive, restart_rows, quality, threads, out, &stats))
+			return FALSE;
+
+		keepBest(i, start, secs, best, &stats);
+	}
+
+	return TRUE;
+}
+
+static int benchDecode(JSAMPARRAY rows, bench_stream* in, int iterations, double* secs, ps_jpeg_stats* best) {
+	for (int i = 0; i < iterations; i++) {
+		ps_jpeg_stats stats;
+		double start = now();
+		if (!decode(rows, in, &stats))
+			return FALSE;
+
+		keepBest(i, start, secs, best, &stats);
+	}
+
+	return TRUE;
+}
+
+static int benchSize(const bench_size* size, int threads, int iterations, int quality, bench_stream* stream) {
+	JSAMPLE* pixels = makeImage(size->width, size->height, 3);
+	JSAMPLE* gray = makeImage(size->width, size->height, 1);
+	JSAMPLE* output = (JSAMPLE*)malloc((size_t)size->width * size->height * 3);
+	JSAMPARRAY rows = (JSAMPARRAY)malloc(size->height * sizeof(JSAMPROW));
+	JSAMPARRAY out_rows = (JSAMPARRAY)malloc(size->height * sizeof(JSAMPROW));
+	int ok = pixels && gray && output && rows && out_rows;
+
+	for (size_t s = 0; ok && s < sizeof(samplings) / sizeof(samplings[0]); s++) {
+		const bench_sampling* samp = &samplings[s];
+		size_t stride = (size_t)size->width * samp->components;
+		double mb = (double)stride * size->height / (1024 * 1024);
+
+		for (JDIMENSION y = 0; y < size->height; y++) {
+			rows[y] = (samp->components == 1 ? gray : pixels) + stride * y;
+			out_rows[y] = output + stride * y;
+		}
+
+		for (int progressive = 0; ok && progressive <= 1; progressive++) {
+			double st, mt, dt;
+			ps_jpeg_stats es, ps, ds;
+			ok = benchEncode(rows, size, samp, progressive, 0, quality, 1, iterations, stream, &st, &es) &&
+				benchEncode(rows, size, samp, progressive, 0, quality, threads, iterations, stream, &mt, &ps) &&
+				benchDecode(out_rows, stream, iterations, &dt, &ds);
+
+			if (ok)
+				printf("%5ux%-5u %-6s %-5s %10zu %9.1f %9.1f %9.1f %8.2f %8.2f %8.2f %8.2f %7llu %7.2f %7llu %7.2f\n",
+					size->width, size->height, samp->name, progressive ? "prog" : "base", stream->len, mb / st, mb / mt, mb / dt,
+					ms(ds.stage_ns[PS_JPEG_STAGE_HEADER]), ms(ds.stage_ns[PS_JPEG_STAGE_START]),
+					ms(ds.stage_ns[PS_JPEG_STAGE_PIXELS]), ms(ds.stage_ns[PS_JPEG_STAGE_FINISH]),
+					(unsigned long long)ds.read_calls, ms(ds.callback_ns), (unsigned long long)es.write_calls, ms(es.callback_ns));
+		}
+	}
+
+	free(out_rows);
+	free(rows);
+	free(output);
+	free(gray);
+	free(pixels);
+	return ok;
+}
+
+static int runCorpus(int argc, char** argv) {
+	int threads = argc > 0 ? atoi(argv[0]) : 4;
+	int iterations = argc > 1 ? atoi(argv[1]) : 3;
+	int quality = argc > 2 ? atoi(argv[2]) : 85;
+
+	if (threads < 1 || iterations < 1 || quality < 1 || quality > 100)
+		return -1;
+
+	printf("psjpeg %d, quality %d, %d thread(s), best of %d\n", JpegVersion(), quality, threads, iterations);
+	printf("decode stage and callback times in ms are from the fastest single-threaded run\n\n");
+	printf("size        sample scan       bytes enc MB/s  %2dT MB/s dec MB/s   header    start   pixels   finish   reads read ms  writes wrt ms\n", threads);
+
+	bench_stream stream = { NULL, 0, 0, 0 };
+	int ok = TRUE;
+	for (size_t i = 0; ok && i < sizeof(sizes) / sizeof(sizes[0]); i++)
+		ok = benchSize(&sizes[i], threads, iterations, quality, &stream);
+
+	free(stream.data);
+	return ok;
+}
+
+static int runRestart(int argc, char** argv) {
+	JDIMENSION width = argc > 0 ? (JDIMENSION)atoi(argv[0]) : 6000;
+	JDIMENSION height = argc > 1 ? (JDIMENSION)atoi(argv[1]) : 4000;
+	int threads = argc > 2 ? atoi(argv[2]) : 4;
+	int iterations = argc > 3 ? atoi(argv[3]) : 3;
+
+	if (!width || !height || threads < 1 || iterations < 1)
+		return -1;
+
+	const bench_size size = { width, height };
+	const bench_sampling* samp = &samplings[2];
+	JSAMPLE* pixels = makeImage(width, height, 3);
+	JSAMPARRAY rows = (JSAMPARRAY)malloc(height * sizeof(JSAMPROW));
+	bench_stream stream = { NULL, 0, 0, 0 };
+	int ok = pixels && rows;
+
+	for (JDIMENSION y = 0; ok && y < height; y++)
+		rows[y] = pixels + (size_t)width * 3 * y;
+
+	double mb = (double)width * height * 3 / (1024 * 1024);
+	printf("psjpeg %d, %ux%u RGB 4:2:0, %d thread(s), best of %d\n\n", JpegVersion(), width, height, threads, iterations);
+	printf("quality   1T MB/s   %2dT MB/s   speedup    no RST bytes   strip bytes  RSTs  overhead   row RST bytes  RSTs  overhead\n", threads);
+
+	for (size_t i = 0; ok && i < sizeof(qualities) / sizeof(qualities[0]); i++) {
+		double st, mt, rt;
+		size_t ss, ps, rs;
+		unsigned pm, rm;
+		ps_jpeg_stats stats;
+		ok = benchEncode(rows, &size, samp, FALSE, 0, qualities[i], 1, iterations, &stream, &st, &stats);
+		ss = stream.len;
+		ok = ok && benchEncode(rows, &size, samp, FALSE, 0, qualities[i], threads, iterations, &stream, &mt, &stats);
+		ps = stream.len;
+		pm = countMarkers(stream.data, stream.len);
+		ok = ok && benchEncode(rows, &size, samp, FALSE, 1, qualities[i], 1, 1, &stream, &rt, &stats);
+		rs = stream.len;
+		rm = countMarkers(stream.data, stream.len);
+
+		if (ok)
+			printf("%7d %9.1f %11.1f %8.2fx %15zu %13zu %5u %+8.3f%% %15zu %5u %+8.3f%%\n",
+				qualities[i], mb / st, mb / mt, st / mt, ss, ps, pm, ((double)ps - (double)ss) * 100 / (double)ss,
+				rs, rm, ((double)rs - (double)ss) * 100 / (double)ss);
+	}
+
+	free(stream.data);
+	free(rows);
+	free(pixels);
+	return ok;
+}
+
+int main(int argc, char** argv) {
+	int res;
+	if (argc < 2) {
+		res = runCorpus(0, NULL);
+		printf("\n");
+		res = res > 0 && runRestart(0, NULL);
+	}
+	else if (!strcmp(argv[1], "corpus"))
+		res = runCorpus(argc - 2, argv + 2);
+	else if (!strcmp(argv[1], "restart"))
+		res = runRestart(argc - 2, argv + 2);
+	else
+		res = -1;
+
+	if (res < 0) {
+		fprintf(stderr, "usage: %s corpus [threads] [iterations] [quality]\n", argv[0]);
+		fprintf(stderr, "       %s restart [width] [height] [threads] [iterations]\n", argv[0]);
+		return 1;
+	}
+
+	return res ? 0 : 1;
+}
@@ -0,0 +1,697 @@
+// Copyright © Clinton Ingram and Contributors.  Licensed under the MIT License.
+
+// Regression tests for the psjpeg extensions.  Each test encodes synthetic images with psjpeg and checks the results
+// of the extended decode paths against the same data decoded through the plain libjpeg calls.
+//
+// usage: psjpegtest
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "psjpeg.h"
+#include "transupp.h"
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("FAIL %s:%d: ", __func__, __LINE__); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		fails++; \
+	} \
+} while (0)
+
+typedef struct {
+	JDIMENSION width;
+	JDIMENSION height;
+	int components;
+	int h_samp;
+	int v_samp;
+	unsigned int restart_interval;
+	int restart_in_rows;
+} test_image;
+
+typedef struct {
+	JOCTET* data;
+	size_t len;
+} test_buffer;
+
+// Output rows for one decode, either interleaved scanlines or one set of rows per component for raw data.
+typedef struct {
+	JSAMPLE* pixels;
+	size_t size;
+	JSAMPARRAY scanlines;
+	JSAMPARRAY planes[MAX_COMPONENTS];
+	JDIMENSION plane_rows[MAX_COMPONENTS];
+} test_output;
+
+// Gradients with noise in the low bits, so every MCU has AC energy and chroma varies between rows.
+static JSAMPLE* makePixels(const test_image* img) {
+	size_t stride = (size_t)img->width * img->components;
+	JSAMPLE* pixels = (JSAMPLE*)malloc(stride * img->height);
+	if (!pixels)
+		return NULL;
+
+	uint32_t seed = 0x2545f491 ^ img->width ^ (img->height << 16);
+	for (JDIMENSION y = 0; y < img->height; y++) {
+		JSAMPLE* row = pixels + stride * y;
+		for (size_t x = 0; x < stride; x++) {
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+
+			row[x] = (JSAMPLE)((x * 3 + y * 5 + (x % img->components) * 85) / 4 + (seed & 31));
+		}
+	}
+
+	return pixels;
+}
+
+static int encode(const test_image* img, int progressive, test_buffer* out) {
+	size_t stride = (size_t)img->width * img->components;
+	JSAMPLE* pixels = makePixels(img);
+	j_compress_ptr cinfo = JpegCreateCompress();
+	int ok = pixels && cinfo;
+
+	out->data = NULL;
+	if (ok) {
+		cinfo->image_width = img->width;
+		cinfo->image_height = img->height;
+		cinfo->input_components = img->components;
+		cinfo->in_color_space = img->components == 1 ? JCS_GRAYSCALE : JCS_RGB;
+
+		ok = JpegSetMemoryDest(cinfo) && JpegSetDefaults(cinfo) && JpegSetQuality(cinfo, 90) && (!progressive || JpegSimpleProgression(cinfo));
+	}
+
+	if (ok) {
+		if (img->components == 3) {
+			cinfo->comp_info[0].h_samp_factor = img->h_samp;
+			cinfo->comp_info[0].v_samp_factor = img->v_samp;
+		}
+
+		cinfo->restart_interval = img->restart_interval;
+		cinfo->restart_in_rows = img->restart_in_rows;
+		ok = JpegStartCompress(cinfo);
+	}
+
+	while (ok && cinfo->next_scanline < cinfo->image_height) {
+		JSAMPROW row = pixels + stride * cinfo->next_scanline;
+		JDIMENSION written;
+		ok = JpegWriteScanlines(cinfo, &row, 1, &written);
+	}
+
+	ok = ok && JpegFinishCompress(cinfo);
+	if (ok) {
+		const JOCTET* buff;
+		JpegGetMemoryDest(cinfo, &buff, &out->len);
+		out->data = (JOCTET*)malloc(out->len);
+		ok = out->data != NULL;
+		if (ok)
+			memcpy(out->data, buff, out->len);
+	}
+	else if (cinfo)
+		printf("encode failed: %s\n", JpegGetLastError((j_common_ptr)cinfo));
+
+	if (cinfo)
+		JpegDestroy((j_common_ptr)cinfo);
+
+	free(pixels);
+	return ok;
+}
+
+static j_decompress_ptr openRead(const test_buffer* jpg) {
+	j_decompress_ptr cinfo = JpegCreateDecompress();
+	if (!cinfo)
+		return NULL;
+
+	if (!JpegSetMemorySource(cinfo, jpg->data, jpg->len) || !JpegReadHeader(cinfo)) {
+		printf("open failed: %s\n", JpegGetLastError((j_common_ptr)cinfo));
+		JpegDestroy((j_common_ptr)cinfo);
+		return NULL;
+	}
+
+	return cinfo;
+}
+
+static void releaseOutput(test_output* out) {
+	for (int ci = 0; ci < MAX_COMPONENTS; ci++)
+		free(out->planes[ci]);
+
+	free(out->scanlines);
+	free(out->pixels);
+	memset(out, 0, sizeof(test_output));
+}
+
+// Allocates output rows for the dimensions set by JpegCalcOutputDimensions.  Raw planes cover whole iMCU rows,
+// since that is what JpegReadRawData writes.
+static int allocOutput(j_decompress_ptr cinfo, test_output* out) {
+	memset(out, 0, sizeof(test_output));
+
+	if (!cinfo->raw_data_out) {
+		size_t stride = (size_t)cinfo->output_width * cinfo->output_components;
+		out->size = stride * cinfo->output_height;
+		out->pixels = (JSAMPLE*)calloc(1, out->size);
+		out->scanlines = (JSAMPARRAY)malloc(cinfo->output_height * sizeof(JSAMPROW));
+		if (!out->pixels || !out->scanlines)
+			return FALSE;
+
+		for (JDIMENSION y = 0; y < cinfo->output_height; y++)
+			out->scanlines[y] = out->pixels + stride * y;
+
+		return TRUE;
+	}
+
+	size_t offs[MAX_COMPONENTS];
+	for (int ci = 0; ci < cinfo->num_components; ci++) {
+		jpeg_component_info* comp = &cinfo->comp_info[ci];
+		offs[ci] = out->size;
+		out->plane_rows[ci] = cinfo->total_iMCU_rows * comp->v_samp_factor * comp->DCT_scaled_size;
+		out->size += (size_t)comp->width_in_blocks * comp->DCT_scaled_size * out->plane_rows[ci];
+	}
+
+	out->pixels = (JSAMPLE*)calloc(1, out->size);
+	if (!out->pixels)
+		return FALSE;
+
+	for (int ci = 0; ci < cinfo->num_components; ci++) {
+		jpeg_component_info* comp = &cinfo->comp_info[ci];
+		size_t stride = (size_t)comp->width_in_blocks * comp->DCT_scaled_size;
+
+		out->planes[ci] = (JSAMPARRAY)malloc(out->plane_rows[ci] * sizeof(JSAMPROW));
+		if (!out->planes[ci])
+			return FALSE;
+
+		for (JDIMENSION y = 0; y < out->plane_rows[ci]; y++)
+			out->planes[ci][y] = out->pixels + offs[ci] + stride * y;
+	}
+
+	return TRUE;
+}
+
+// Reads the image with JpegReadScanlines or JpegReadRawData, one call per row or iMCU row.
+static int readSequential(j_decompress_ptr cinfo, test_output* out) {
+	int ok = JpegStartDecompress(cinfo);
+
+	if (!cinfo->raw_data_out) {
+		while (ok && cinfo->output_scanline < cinfo->output_height) {
+			JDIMENSION read;
+			ok = JpegReadScanlines(cinfo, out->scanlines + cinfo->output_scanline, 1, &read) && read == 1;
+		}
+	}
+	else {
+		JDIMENSION lines = cinfo->max_v_samp_factor * cinfo->min_DCT_scaled_size;
+		for (JDIMENSION row = 0; ok && row < cinfo->total_iMCU_rows; row++) {
+			JSAMPARRAY planes[MAX_COMPONENTS];
+			for (int ci = 0; ci < cinfo->num_components; ci++) {
+				jpeg_component_info* comp = &cinfo->comp_info[ci];
+				planes[ci] = out->planes[ci] + (size_t)row * comp->v_samp_factor * comp->DCT_scaled_size;
+			}
+
+			JDIMENSION read;
+			ok = JpegReadRawData(cinfo, planes, lines, &read) && read == lines;
+		}
+	}
+
+	return ok && JpegFinishDecompress(cinfo);
+}
+
+// Decodes at 1/scale, with threads == 0 meaning the plain sequential calls rather than JpegDecodeBandsParallel.
+static int decode(const test_buffer* jpg, int scale, int raw, int threads, test_output* out) {
+	j_decompress_ptr cinfo = openRead(jpg);
+	int ok = cinfo != NULL;
+
+	memset(out, 0, sizeof(test_output));
+	if (ok) {
+		cinfo->scale_num = 1;
+		cinfo->scale_denom = scale;
+		cinfo->raw_data_out = raw;
+		if (raw)
+			cinfo->out_color_space = cinfo->jpeg_color_space;
+
+		ok = JpegCalcOutputDimensions(cinfo) && allocOutput(cinfo, out);
+	}
+
+	if (ok)
+		ok = threads ? JpegDecodeBandsParallel(cinfo, out->scanlines, out->planes, threads) : readSequential(cinfo, out);
+
+	if (!ok && cinfo)
+		printf("decode failed: %s\n", JpegGetLastError((j_common_ptr)cinfo));
+
+	if (cinfo)
+		JpegDestroy((j_common_ptr)cinfo);
+
+	return ok;
+}
+
+// Checks every thread count, output scale and output layout against the sequential decode.
+static int testParallelBands(const test_image* img) {
+	static const int scales[] = { 1, 2, 8 };
+	static const int threads[] = { 2, 3, 8 };
+
+	int fails = 0;
+	test_buffer jpg;
+	CHECK(encode(img, FALSE, &jpg), "encode %ux%u components %d sampling %dx%d restart %u/%d", img->width, img->height,
+		img->components, img->h_samp, img->v_samp, img->restart_interval, img->restart_in_rows);
+
+	for (int raw = 0; raw < 2 && !fails; raw++) {
+		for (size_t s = 0; s < sizeof(scales) / sizeof(scales[0]) && !fails; s++) {
+			test_output expected;
+			CHECK(decode(&jpg, scales[s], raw, 0, &expected), "sequential decode at 1/%d raw %d", scales[s], raw);
+
+			for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]) && !fails; t++) {
+				test_output actual;
+				CHECK(decode(&jpg, scales[s], raw, threads[t], &actual), "parallel decode at 1/%d raw %d threads %d", scales[s], raw, threads[t]);
+				CHECK(!fails && actual.size == expected.size && !memcmp(actual.pixels, expected.pixels, expected.size),
+					"%ux%u sampling %dx%d restart %u/%d at 1/%d raw %d threads %d differs from sequential decode", img->width,
+					img->height, img->h_samp, img->v_samp, img->restart_interval, img->restart_in_rows, scales[s], raw, threads[t]);
+
+				releaseOutput(&actual);
+			}
+
+			releaseOutput(&expected);
+		}
+	}
+
+	free(jpg.data);
+	return fails;
+}
+
+// Quantized coefficients and quantization tables for each component of an image, read back with
+// JpegReadCoefficients so transformed and requantized output can be compared block by block.
+typedef struct {
+	JDIMENSION width;
+	JDIMENSION height;
+	int num_components;
+	int max_h_samp;
+	int max_v_samp;
+	int h_samp[MAX_COMPONENTS];
+	int v_samp[MAX_COMPONENTS];
+	JDIMENSION width_in_blocks[MAX_COMPONENTS];
+	JDIMENSION height_in_blocks[MAX_COMPONENTS];
+	UINT16 quant[MAX_COMPONENTS][DCTSIZE2];
+	JCOEF* blocks[MAX_COMPONENTS];
+} test_coefs;
+
+static void releaseCoefs(test_coefs* coefs) {
+	for (int ci = 0; ci < MAX_COMPONENTS; ci++)
+		free(coefs->blocks[ci]);
+
+	memset(coefs, 0, sizeof(test_coefs));
+}
+
+static int readCoefs(const test_buffer* jpg, test_coefs* out) {
+	j_decompress_ptr cinfo = openRead(jpg);
+	jvirt_barray_ptr* arrays = NULL;
+	int ok = cinfo && JpegReadCoefficients(cinfo, &arrays);
+
+	memset(out, 0, sizeof(test_coefs));
+	if (ok) {
+		out->width = cinfo->image_width;
+		out->height = cinfo->image_height;
+		out->num_components = cinfo->num_components;
+		out->max_h_samp = cinfo->max_h_samp_factor;
+		out->max_v_samp = cinfo->max_v_samp_factor;
+	}
+
+	for (int ci = 0; ok && ci < cinfo->num_components; ci++) {
+		jpeg_component_info* comp = &cinfo->comp_info[ci];
+		out->h_samp[ci] = comp->h_samp_factor;
+		out->v_samp[ci] = comp->v_samp_factor;
+		out->width_in_blocks[ci] = comp->width_in_blocks;
+		out->height_in_blocks[ci] = comp->height_in_blocks;
+		memcpy(out->quant[ci], comp->quant_table->quantval, sizeof(out->quant[ci]));
+
+		size_t row_size = (size_t)comp->width_in_blocks * DCTSIZE2;
+		out->blocks[ci] = (JCOEF*)malloc(row_size * comp->height_in_blocks * sizeof(JCOEF));
+		ok = out->blocks[ci] != NULL;
+
+		for (JDIMENSION by = 0; ok && by < comp->height_in_blocks; by++) {
+			JBLOCKARRAY row;
+			ok = JpegAccessCoefficients((j_common_ptr)cinfo, arrays[ci], by, 1, FALSE, &row);
+			if (ok)
+				memcpy(out->blocks[ci] + row_size * by, row[0], row_size * sizeof(JCOEF));
+		}
+	}
+
+	if (!ok && cinfo)
+		printf("coefficient read failed: %s\n", JpegGetLastError((j_common_ptr)cinfo));
+
+	if (cinfo)
+		JpegDestroy((j_common_ptr)cinfo);
+
+	if (!ok)
+		releaseCoefs(out);
+
+	return ok;
+}
+
+// Copies the finished output of a compressor, or the compressor's error message on failure.
+static int finishOutput(j_compress_ptr cinfo, int ok, test_buffer* out, char* msg) {
+	out->data = NULL;
+	msg[0] = '\0';
+
+	ok = ok && JpegFinishCompress(cinfo);
+	if (ok) {
+		const JOCTET* buff;
+		JpegGetMemoryDest(cinfo, &buff, &out->len);
+		out->data = (JOCTET*)malloc(out->len);
+		ok = out->data != NULL;
+		if (ok)
+			memcpy(out->data, buff, out->len);
+	}
+	else
+		snprintf(msg, JMSG_LENGTH_MAX, "%s", JpegGetLastError((j_common_ptr)cinfo));
+
+	return ok;
+}
+
+static int transform(const test_buffer* jpg, int xform, const JDIMENSION* crop, int flags, test_buffer* out, char* msg) {
+	j_decompress_ptr src = openRead(jpg);
+	j_compress_ptr cinfo = JpegCreateCompress();
+	int ok = src && cinfo && JpegSetMemoryDest(cinfo);
+
+	ok = ok && JpegTransform(src, cinfo, xform, crop[0], crop[1], crop[2], crop[3], flags);
+	ok = finishOutput(cinfo, ok, out, msg) && JpegFinishDecompress(src);
+
+	if (cinfo)
+		JpegDestroy((j_common_ptr)cinfo);
+	if (src)
+		JpegDestroy((j_common_ptr)src);
+
+	return ok;
+}
+
+static const char* const transform_names[] = { "none", "flip_h", "flip_v", "transpose", "transverse", "rot_90", "rot_180", "rot_270" };
+
+// Checks transformed coefficients the way jpegtran defines them.  Each transform mirrors the source along zero, one or
+// both axes, and the transposing ones also swap the axes and the sampling factors.  Mirroring reverses the whole MCUs
+// along an axis and negates the odd frequencies along it, while partial MCUs at the right or bottom edge of the source
+// stay where they are, unmirrored, unless TRIM drops them.  Crop offsets here are MCU-aligned, so they only shift blocks.
+static int checkTransform(const test_coefs* src, const test_coefs* dst, int xform, int flags, const JDIMENSION* crop) {
+	int transposed = xform == JXFORM_TRANSPOSE || xform == JXFORM_TRANSVERSE || xform == JXFORM_ROT_90 || xform == JXFORM_ROT_270;
+	int mirror_x = xform == JXFORM_FLIP_H || xform == JXFORM_TRANSVERSE || xform == JXFORM_ROT_180 || xform == JXFORM_ROT_270;
+	int mirror_y = xform == JXFORM_FLIP_V || xform == JXFORM_TRANSVERSE || xform == JXFORM_ROT_90 || xform == JXFORM_ROT_180;
+	JDIMENSION mcu_width = src->max_h_samp * DCTSIZE, mcu_height = src->max_v_samp * DCTSIZE;
+	const char* name = transform_names[xform];
+
+	JDIMENSION width = src->width, height = src->height;
+	if (crop[2] && crop[3]) {
+		width = crop[2];
+		height = crop[3];
+	}
+	if (mirror_x && (flags & PS_TRANSFORM_TRIM))
+		width = width / mcu_width * mcu_width;
+	if (mirror_y && (flags & PS_TRANSFORM_TRIM))
+		height = height / mcu_height * mcu_height;
+
+	int fails = 0;
+	CHECK(dst->width == (transposed ? height : width) && dst->height == (transposed ? width : height),
+		"%s flags %d: %ux%u output is %ux%u", name, flags, src->width, src->height, dst->width, dst->height);
+	CHECK(dst->num_components == src->num_components, "%s flags %d: component count changed", name, flags);
+
+	for (int ci = 0; !fails && ci < src->num_components; ci++) {
+		int h_samp = src->h_samp[ci], v_samp = src->v_samp[ci];
+		CHECK(dst->h_samp[ci] == (transposed ? v_samp : h_samp) && dst->v_samp[ci] == (transposed ? h_samp : v_samp),
+			"%s flags %d: component %d sampling %dx%d became %dx%d", name, flags, ci, h_samp, v_samp, dst->h_samp[ci], dst->v_samp[ci]);
+		CHECK(!memcmp(dst->quant[ci], src->quant[ci], sizeof(src->quant[ci])), "%s flags %d: component %d quant table changed", name, flags, ci);
+
+		// Blocks along each source axis that belong to whole MCUs and so get mirrored.
+		JDIMENSION mirror_cols = src->width / mcu_width * h_samp, mirror_rows = src->height / mcu_height * v_samp;
+		JDIMENSION crop_cols = crop[0] / mcu_width * h_samp, crop_rows = crop[1] / mcu_height * v_samp;
+		size_t src_stride = (size_t)src->width_in_blocks[ci] * DCTSIZE2, dst_stride = (size_t)dst->width_in_blocks[ci] * DCTSIZE2;
+
+		for (JDIMENSION oy = 0; !fails && oy < dst->height_in_blocks[ci]; oy++) {
+			for (JDIMENSION ox = 0; !fails && ox < dst->width_in_blocks[ci]; ox++) {
+				JDIMENSION px = transposed ? oy : ox, py = transposed ? ox : oy;
+				int flip_x = mirror_x && px < mirror_cols, flip_y = mirror_y && py < mirror_rows;
+				JDIMENSION sx = (flip_x ? mirror_cols - 1 - px : px) + crop_cols, sy = (flip_y ? mirror_rows - 1 - py : py) + crop_rows;
+
+				CHECK(sx < src->width_in_blocks[ci] && sy < src->height_in_blocks[ci], "%s flags %d: component %d block %u,%u has no source",
+					name, flags, ci, ox, oy);
+				if (fails)
+					break;
+
+				const JCOEF* sblock = src->blocks[ci] + src_stride * sy + (size_t)sx * DCTSIZE2;
+				const JCOEF* dblock = dst->blocks[ci] + dst_stride * oy + (size_t)ox * DCTSIZE2;
+				for (int v = 0; !fails && v < DCTSIZE; v++) {
+					for (int u = 0; u < DCTSIZE; u++) {
+						int su = transposed ? v : u, sv = transposed ? u : v;
+						int negate = (flip_x && (su & 1)) ^ (flip_y && (sv & 1));
+						JCOEF expected = sblock[sv * DCTSIZE + su];
+						if (negate)
+							expected = -expected;
+
+						CHECK(dblock[v * DCTSIZE + u] == expected, "%s flags %d: component %d block %u,%u coefficient %d,%d is %d, expected %d",
+							name, flags, ci, ox, oy, u, v, dblock[v * DCTSIZE + u], expected);
+						if (fails)
+							break;
+					}
+				}
+			}
+		}
+	}
+
+	return fails;
+}
+
+// Runs every transform with and without trimming, and checks that PERFECT fails exactly when an edge would be left
+// unmirrored.  Transposing alone mirrors nothing, so it never needs trimming.
+static int testTransforms(const test_image* img, int progressive) {
+	static const JDIMENSION no_crop[4] = { 0 };
+
+	int fails = 0;
+	test_buffer jpg;
+	test_coefs src;
+	CHECK(encode(img, progressive, &jpg), "encode %ux%u sampling %dx%d", img->width, img->height, img->h_samp, img->v_samp);
+	CHECK(!fails && readCoefs(&jpg, &src), "read source coefficients");
+	if (fails) {
+		free(jpg.data);
+		return fails;
+	}
+
+	JDIMENSION mcu_width = src.max_h_samp * DCTSIZE, mcu_height = src.max_v_samp * DCTSIZE;
+	int partial_x = img->width % mcu_width != 0, partial_y = img->height % mcu_height != 0;
+
+	for (int xform = JXFORM_NONE; xform <= JXFORM_ROT_270; xform++) {
+		static const int flag_sets[] = { 0, PS_TRANSFORM_TRIM, PS_TRANSFORM_TRIM | PS_TRANSFORM_OPTIMIZE | PS_TRANSFORM_PROGRESSIVE };
+
+		for (size_t f = 0; f < sizeof(flag_sets) / sizeof(flag_sets[0]); f++) {
+			test_buffer out;
+			test_coefs dst;
+			char msg[JMSG_LENGTH_MAX];
+			int ok = transform(&jpg, xform, no_crop, flag_sets[f], &out, msg) && readCoefs(&out, &dst);
+			CHECK(ok, "%ux%u %s flags %d failed: %s", img->width, img->height, transform_names[xform], flag_sets[f], msg);
+			if (ok) {
+				fails += checkTransform(&src, &dst, xform, flag_sets[f], no_crop);
+				releaseCoefs(&dst);
+			}
+
+			free(out.data);
+		}
+
+		int mirror_x = xform == JXFORM_FLIP_H || xform == JXFORM_TRANSVERSE || xform == JXFORM_ROT_180 || xform == JXFORM_ROT_270;
+		int mirror_y = xform == JXFORM_FLIP_V || xform == JXFORM_TRANSVERSE || xform == JXFORM_ROT_90 || xform == JXFORM_ROT_180;
+		int perfect = !(mirror_x && partial_x) && !(mirror_y && partial_y);
+
+		test_buffer out;
+		char msg[JMSG_LENGTH_MAX];
+		int ok = transform(&jpg, xform, no_crop, PS_TRANSFORM_PERFECT, &out, msg);
+		CHECK(ok == perfect, "%ux%u %s with PERFECT %s", img->width, img->height, transform_names[xform], ok ? "succeeded" : msg);
+		CHECK(ok || !strcmp(msg, "Transform requires trimming partial MCUs, and PS_TRANSFORM_PERFECT was requested."),
+			"%s with PERFECT failed with \"%s\"", transform_names[xform], msg);
+
+		free(out.data);
+	}
+
+	// Crops at MCU offsets, with a size that ends partway through an MCU.
+	JDIMENSION crop[4] = { mcu_width * 2, mcu_height, img->width - mcu_width * 3 + 3, img->height - mcu_height * 2 - 5 };
+	test_buffer out;
+	test_coefs dst;
+	char msg[JMSG_LENGTH_MAX];
+	int ok = transform(&jpg, JXFORM_NONE, crop, 0, &out, msg) && readCoefs(&out, &dst);
+	CHECK(ok, "%ux%u crop %ux%u+%u+%u failed: %s", img->width, img->height, crop[2], crop[3], crop[0], crop[1], msg);
+	if (ok) {
+		fails += checkTransform(&src, &dst, JXFORM_NONE, 0, crop);
+		releaseCoefs(&dst);
+	}
+
+	free(out.data);
+	releaseCoefs(&src);
+	free(jpg.data);
+	return fails;
+}
+
+// Requantizes to the tables for each quality and checks every coefficient against the source value rescaled to the
+// new quantizer and rounded half away from zero.  The source quality reproduces the source tables, so nothing changes.
+static int testRequantize(const test_image* img) {
+	static const int qualities[] = { 90, 75, 50, 20 };
+
+	int fails = 0;
+	test_buffer jpg;
+	test_coefs src;
+	CHECK(encode(img, FALSE, &jpg), "encode %ux%u sampling %dx%d", img->width, img->height, img->h_samp, img->v_samp);
+	CHECK(!fails && readCoefs(&jpg, &src), "read source coefficients");
+	if (fails) {
+		free(jpg.data);
+		return fails;
+	}
+
+	for (size_t q = 0; q < sizeof(qualities) / sizeof(qualities[0]); q++) {
+		j_decompress_ptr srcinfo = openRead(&jpg);
+		j_compress_ptr cinfo = JpegCreateCompress();
+		jvirt_barray_ptr* arrays = NULL;
+		test_buffer out;
+		test_coefs dst;
+		char msg[JMSG_LENGTH_MAX];
+
+		int ok = srcinfo && cinfo && JpegSetMemoryDest(cinfo) && JpegReadCoefficients(srcinfo, &arrays);
+		ok = ok && JpegCopyCriticalParameters(srcinfo, cinfo) && JpegSetQuality(cinfo, qualities[q]);
+		ok = ok && JpegRequantize(srcinfo, cinfo, arrays) && JpegWriteCoefficients(cinfo, arrays);
+		ok = finishOutput(cinfo, ok, &out, msg) && JpegFinishDecompress(srcinfo) && readCoefs(&out, &dst);
+		CHECK(ok, "requantize to quality %d failed: %s", qualities[q], msg);
+
+		for (int ci = 0; ok && !fails && ci < src.num_components; ci++) {
+			CHECK(dst.width_in_blocks[ci] == src.width_in_blocks[ci] && dst.height_in_blocks[ci] == src.height_in_blocks[ci],
+				"quality %d component %d size changed", qualities[q], ci);
+
+			size_t count = (size_t)src.width_in_blocks[ci] * src.height_in_blocks[ci] * DCTSIZE2;
+			for (size_t i = 0; !fails && i < count; i++) {
+				long val = (long)src.blocks[ci][i] * src.quant[ci][i % DCTSIZE2];
+				long div = dst.quant[ci][i % DCTSIZE2];
+				long expected = (labs(val) * 2 + div) / (div * 2);
+				if (val < 0)
+					expected = -expected;
+
+				CHECK(dst.blocks[ci][i] == expected, "quality %d component %d block %zu coefficient %zu is %d, expected %ld",
+					qualities[q], ci, i / DCTSIZE2, i % DCTSIZE2, dst.blocks[ci][i], expected);
+			}
+		}
+
+		if (ok)
+			releaseCoefs(&dst);
+
+		free(out.data);
+		if (cinfo)
+			JpegDestroy((j_common_ptr)cinfo);
+		if (srcinfo)
+			JpegDestroy((j_common_ptr)srcinfo);
+	}
+
+	releaseCoefs(&src);
+	free(jpg.data);
+	return fails;
+}
+
+// Errors raised on the source handle must reach the caller through the destination handle's message.
+static int testChainedErrors(const test_image* img) {
+	int fails = 0;
+	test_buffer jpg;
+	CHECK(encode(img, TRUE, &jpg), "encode %ux%u progressive", img->width, img->height);
+	if (fails)
+		return fails;
+
+	// A source that has not read its header is in the wrong state for a transform.
+	j_decompress_ptr src = JpegCreateDecompress();
+	j_compress_ptr cinfo = JpegCreateCompress();
+	CHECK(src && cinfo && JpegSetMemorySource(src, jpg.data, jpg.len) && JpegSetMemoryDest(cinfo), "create handles");
+	if (!fails) {
+		CHECK(!JpegTransform(src, cinfo, JXFORM_ROT_90, 0, 0, 0, 0, 0), "transform before reading the header succeeded");
+		const char* err = JpegGetLastError((j_common_ptr)cinfo);
+		CHECK(err[0] && !strcmp(err, JpegGetLastError((j_common_ptr)src)), "bad state error \"%s\" was not chained", err);
+	}
+
+	if (cinfo)
+		JpegDestroy((j_common_ptr)cinfo);
+	if (src)
+		JpegDestroy((j_common_ptr)src);
+
+	// Requantizing needs the source coefficients already read.
+	src = openRead(&jpg);
+	cinfo = JpegCreateCompress();
+	CHECK(src && cinfo && JpegSetMemoryDest(cinfo), "create handles");
+	if (src && cinfo) {
+		jvirt_barray_ptr arrays[MAX_COMPONENTS] = { 0 };
+		CHECK(!JpegRequantize(src, cinfo, arrays), "requantize before reading coefficients succeeded");
+		const char* err = JpegGetLastError((j_common_ptr)cinfo);
+		CHECK(err[0] && !strcmp(err, JpegGetLastError((j_common_ptr)src)), "bad state error \"%s\" was not chained", err);
+	}
+
+	if (cinfo)
+		JpegDestroy((j_common_ptr)cinfo);
+	if (src)
+		JpegDestroy((j_common_ptr)src);
+
+	// Transform codes outside the JXFORM_NONE..JXFORM_ROT_270 range are rejected on the destination handle.
+	static const JDIMENSION no_crop[4] = { 0 };
+	test_buffer out;
+	char msg[JMSG_LENGTH_MAX];
+	CHECK(!transform(&jpg, 99, no_crop, 0, &out, msg), "transform code 99 succeeded");
+	CHECK(!strcmp(msg, "Unsupported transform code 99."), "transform code 99 failed with \"%s\"", msg);
+	free(out.data);
+
+	// A component selector that matches no component in the second scan header fails inside jpeg_read_coefficients,
+	// after the first scan has been read.
+	size_t sos = 0;
+	for (size_t i = 0, found = 0; i + 5 < jpg.len && !sos; i++) {
+		if (jpg.data[i] == 0xFF && jpg.data[i + 1] == 0xDA && ++found == 2)
+			sos = i;
+	}
+
+	CHECK(sos, "second scan header not found");
+	if (sos) {
+		jpg.data[sos + 5] = 0x7F;
+
+		src = openRead(&jpg);
+		cinfo = JpegCreateCompress();
+		CHECK(src && cinfo && JpegSetMemoryDest(cinfo), "create handles");
+		if (src && cinfo) {
+			CHECK(!JpegTransform(src, cinfo, JXFORM_FLIP_H, 0, 0, 0, 0, PS_TRANSFORM_TRIM), "transform of corrupt scan succeeded");
+			const char* err = JpegGetLastError((j_common_ptr)cinfo);
+			CHECK(err[0] && !strcmp(err, JpegGetLastError((j_common_ptr)src)), "corrupt scan error \"%s\" was not chained", err);
+			CHECK(strstr(err, "127") != NULL, "corrupt scan error \"%s\" does not name the bad component", err);
+		}
+
+		if (cinfo)
+			JpegDestroy((j_common_ptr)cinfo);
+		if (src)
+			JpegDestroy((j_common_ptr)src);
+	}
+
+	free(jpg.data);
+	return fails;
+}
+
+int main() {
+	// Intervals are in MCUs unless restart_in_rows is set.  Those that don't divide the MCU row width make bands
+	// start only on rows where a row and an interval begin together.  4:2:0 in interleaved output needs the rows on
+	// either side of each band for fancy upsampling, while 4:2:2 is upsampled within each row.
+	static const test_image band_images[] = {
+		{ 640, 480, 3, 2, 2, 0, 1 },
+		{ 517, 389, 3, 2, 2, 7, 0 },
+		{ 257, 1031, 3, 2, 2, 23, 0 },
+		{ 400, 301, 3, 2, 1, 5, 0 },
+		{ 333, 250, 3, 1, 1, 13, 0 },
+		{ 250, 777, 1, 1, 1, 3, 0 }
+	};
+
+	int fails = 0;
+	for (size_t i = 0; i < sizeof(band_images) / sizeof(band_images[0]); i++)
+		fails += testParallelBands(&band_images[i]);
+
+	// Neither size is a whole number of MCUs, except in the last image, so every mirrored axis has a partial edge.
+	static const test_image transform_images[] = {
+		{ 333, 250, 3, 2, 2, 0, 0 },
+		{ 203, 64, 3, 2, 1, 0, 0 },
+		{ 99, 45, 1, 1, 1, 0, 0 },
+		{ 320, 240, 3, 2, 2, 0, 0 }
+	};
+
+	for (size_t i = 0; i < sizeof(transform_images) / sizeof(transform_images[0]); i++)
+		fails += testTransforms(&transform_images[i], i & 1);
+
+	fails += testRequantize(&transform_images[0]);
+	fails += testChainedErrors(&transform_images[0]);
+
+	printf("psjpeg %d: %s (%d failures)\n", JpegVersion(), fails ? "FAILED" : "passed", fails);
+	return fails ? 1 : 0;
+}
@@ -8,7 +8,6 @@
 #define PNG_DISABLE_ADLER32_CHECK_SUPPORTED
 
 #define PNG_NO_SETJMP
-#define PNG_NO_USER_MEM
 #define PNG_NO_STDIO
 #define PNG_NO_WRITE_FLUSH
 #define PNG_NO_WARNINGS
@@ -35,12 +35,19 @@ vcpkg_from_github(
         pspng-customize-code.patch
 )
 
-file(COPY "${CURRENT_PORT_DIR}/pngusr.h" "${CURRENT_PORT_DIR}/pspng.h"
-          "${CURRENT_PORT_DIR}/pspng.c" "${CURRENT_PORT_DIR}/pspng.ver" DESTINATION "${SOURCE_PATH}")
+file(COPY "${CURRENT_PORT_DIR}/pngusr.h" "${CURRENT_PORT_DIR}/pspng.h" "${CURRENT_PORT_DIR}/pspng.c"
+          "${CURRENT_PORT_DIR}/pspng.ver" "${CURRENT_PORT_DIR}/pspngbench.c" "${CURRENT_PORT_DIR}/pspngtest.c"
+          DESTINATION "${SOURCE_PATH}")
 
 set(VCPKG_C_FLAGS -DPNG_USER_CONFIG)
 set(VCPKG_CXX_FLAGS -DPNG_USER_CONFIG)
 
+vcpkg_check_features(OUT_FEATURE_OPTIONS FEATURE_OPTIONS
+    FEATURES
+        bench PSPNG_BENCH
+        test PSPNG_TEST
+)
+
 vcpkg_cmake_configure(
     SOURCE_PATH "${SOURCE_PATH}"
     OPTIONS
@@ -49,12 +56,21 @@ vcpkg_cmake_configure(
         -DPNG_FRAMEWORK=OFF
         -DPNG_TESTS=OFF
         -DSKIP_INSTALL_ALL=ON
+        ${FEATURE_OPTIONS}
     MAYBE_UNUSED_VARIABLES
         PNG_ARM_NEON
 )
 vcpkg_cmake_install()
 vcpkg_copy_pdbs()
 
+if("bench" IN_LIST FEATURES)
+    vcpkg_copy_tools(TOOL_NAMES pspngbench AUTO_CLEAN)
+endif()
+
+if("test" IN_LIST FEATURES)
+    vcpkg_copy_tools(TOOL_NAMES pspngtest AUTO_CLEAN)
+endif()
+
 file(REMOVE_RECURSE "${CURRENT_PACKAGES_DIR}/debug/share"
                     "${CURRENT_PACKAGES_DIR}/debug/include"
 )
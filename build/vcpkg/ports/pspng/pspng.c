@@ -4,6 +4,14 @@
 #include "pngpriv.h"
 #include "pspng.h"
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+
 #ifdef sigsetjmp
 #define SETJMP(e) sigsetjmp((e), 0)
 #define LONGJMP siglongjmp
@@ -18,6 +26,10 @@
 
 #define MSG_BUF_SIZE 256
 #define ZLIB_MEM_LEVEL 9
+#define IO_BUF_SIZE 4096
+#define MT_BLOCK_SIZE (1 << 17)
+#define MT_DICT_SIZE (1 << 15)
+#define MT_MAX_THREADS 64
 
 typedef struct {
 	jmp_buf jmp_buf;
@@ -32,27 +44,1149 @@ static void throwError(png_structp png_ptr, png_const_charp error_message) {
 	LONGJMP(err->jmp_buf, 1);
 }
 
+// Header for arena allocations.  Two pointer-sized fields keep the payload at malloc alignment on 64-bit targets.
+typedef struct ps_arena_block {
+	struct ps_arena_block* next;
+	size_t size;
+} ps_arena_block;
+
+typedef struct {
+	ps_allocator backing;
+	ps_arena_block* cache;
+	size_t cached;
+	size_t limit;
+} ps_arena;
+
+typedef struct ps_mt_block ps_mt_block;
+
+struct ps_mt_block {
+	void (*work)(ps_mt_block*);
+	ps_mt_data* mt;
+	png_bytepp rows;
+	png_const_bytep prev;
+	png_uint_32 num_rows;
+	png_bytep scratch;
+	png_bytep in;
+	size_t in_size;
+	size_t in_len;
+	png_bytep out;
+	size_t out_size;
+	size_t out_len;
+	png_const_bytep dict;
+	size_t dict_len;
+	uLong adler;
+	int last;
+	int status;
+};
+
+struct ps_mt_data {
+	int threads;
+	int enabled;
+	int level;
+	int strategy;
+	int filters;
+	size_t rowbytes;
+	size_t bpp;
+	png_uint_32 height;
+	png_uint_32 block_rows;
+	png_uint_32 rows_done;
+	png_uint_32 staged;
+	png_bytep stage;
+	png_bytepp rows;
+	png_bytep zero_row;
+	png_bytep prev_row;
+	png_bytep scratch;
+	png_bytep dict;
+	size_t dict_len;
+	uLong adler;
+	ps_mt_block blocks[MT_MAX_THREADS];
+};
+
+static void* defaultAlloc(void* state, size_t size) {
+	return malloc(size);
+}
+
+static void defaultFree(void* state, void* mem) {
+	free(mem);
+}
+
+static ps_arena* createArena(const ps_allocator* allocator, size_t limit) {
+	ps_arena* arena = (ps_arena*)malloc(sizeof(ps_arena));
+	if (!arena)
+		return NULL;
+
+	if (allocator) {
+		arena->backing = *allocator;
+	} else {
+		arena->backing.state = NULL;
+		arena->backing.alloc = defaultAlloc;
+		arena->backing.free = defaultFree;
+	}
+
+	arena->cache = NULL;
+	arena->cached = 0;
+	arena->limit = limit;
+
+	return arena;
+}
+
+static void destroyArena(ps_arena* arena) {
+	if (!arena)
+		return;
+
+	while (arena->cache) {
+		ps_arena_block* blk = arena->cache;
+		arena->cache = blk->next;
+		(*arena->backing.free)(arena->backing.state, blk);
+	}
+
+	free(arena);
+}
+
+static void* arenaAlloc(ps_arena* arena, size_t size) {
+	// Best fit from the blocks released by earlier images, refusing any more than twice the request so a
+	// large cached block isn't pinned by a small allocation.
+	ps_arena_block** best = NULL;
+	for (ps_arena_block** pblk = &arena->cache; *pblk; pblk = &(*pblk)->next) {
+		size_t bsize = (*pblk)->size;
+		if (bsize >= size && bsize - size <= size && (!best || bsize < (*best)->size))
+			best = pblk;
+	}
+
+	ps_arena_block* blk;
+	if (best) {
+		blk = *best;
+		*best = blk->next;
+		arena->cached -= blk->size;
+	} else {
+		if (size > SIZE_MAX - sizeof(ps_arena_block))
+			return NULL;
+
+		blk = (ps_arena_block*)(*arena->backing.alloc)(arena->backing.state, size + sizeof(ps_arena_block));
+		if (!blk)
+			return NULL;
+
+		blk->size = size;
+	}
+
+	return blk + 1;
+}
+
+static void arenaFree(ps_arena* arena, void* mem) {
+	if (!mem)
+		return;
+
+	ps_arena_block* blk = (ps_arena_block*)mem - 1;
+	if (arena->cached + blk->size <= arena->limit) {
+		blk->next = arena->cache;
+		arena->cache = blk;
+		arena->cached += blk->size;
+	} else {
+		(*arena->backing.free)(arena->backing.state, blk);
+	}
+}
+
+// libpng user-mem hooks.  These cover the png_struct, info_struct, row and chunk buffers, and zlib's state via png_zalloc.
+static png_voidp pngAlloc(png_structp png_ptr, png_alloc_size_t size) {
+	return arenaAlloc((ps_arena*)png_get_mem_ptr(png_ptr), size);
+}
+
+static void pngFree(png_structp png_ptr, png_voidp ptr) {
+	arenaFree((ps_arena*)png_get_mem_ptr(png_ptr), ptr);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI threadProc(LPVOID arg) {
+	ps_mt_block* blk = (ps_mt_block*)arg;
+	(*blk->work)(blk);
+	return 0;
+}
+#else
+static void* threadProc(void* arg) {
+	ps_mt_block* blk = (ps_mt_block*)arg;
+	(*blk->work)(blk);
+	return NULL;
+}
+#endif
+
+static void runParallel(ps_mt_block* blocks, int count) {
+	// Workers may not call png_error, so each one leaves its result in its block for the calling thread to check.
+#ifdef _WIN32
+	HANDLE threads[MT_MAX_THREADS];
+	for (int i = 1; i < count; i++)
+		threads[i] = CreateThread(NULL, 0, threadProc, &blocks[i], 0, NULL);
+
+	(*blocks[0].work)(&blocks[0]);
+
+	for (int i = 1; i < count; i++) {
+		if (threads[i]) {
+			WaitForSingleObject(threads[i], INFINITE);
+			CloseHandle(threads[i]);
+		} else {
+			(*blocks[i].work)(&blocks[i]);
+		}
+	}
+#else
+	pthread_t threads[MT_MAX_THREADS];
+	int started[MT_MAX_THREADS];
+	for (int i = 1; i < count; i++)
+		started[i] = pthread_create(&threads[i], NULL, threadProc, &blocks[i]) == 0;
+
+	(*blocks[0].work)(&blocks[0]);
+
+	for (int i = 1; i < count; i++) {
+		if (started[i])
+			pthread_join(threads[i], NULL);
+		else
+			(*blocks[i].work)(&blocks[i]);
+	}
+#endif
+}
+
+static size_t filterRow(png_byte type, png_const_bytep row, png_const_bytep prev, png_bytep out, size_t rowbytes, size_t bpp) {
+	size_t sum = 0;
+
+	for (size_t i = 0; i < rowbytes; i++) {
+		int a = i >= bpp ? row[i - bpp] : 0;
+		int b = prev[i];
+		int c = i >= bpp ? prev[i - bpp] : 0;
+		int x = row[i];
+
+		switch (type) {
+			case PNG_FILTER_VALUE_SUB:
+				x -= a;
+				break;
+			case PNG_FILTER_VALUE_UP:
+				x -= b;
+				break;
+			case PNG_FILTER_VALUE_AVG:
+				x -= (a + b) >> 1;
+				break;
+			case PNG_FILTER_VALUE_PAETH: {
+				int p = b - c, pc = a - c;
+				int pa = abs(p), pb = abs(pc);
+				pc = abs(p + pc);
+				x -= (pa <= pb && pa <= pc) ? a : pb <= pc ? b : c;
+				break;
+			}
+		}
+
+		out[i] = (png_byte)x;
+		sum += out[i] < 128 ? out[i] : 256 - out[i];
+	}
+
+	return sum;
+}
+
+static void filterBlock(ps_mt_block* blk) {
+	static const int masks[] = { PNG_FILTER_NONE, PNG_FILTER_SUB, PNG_FILTER_UP, PNG_FILTER_AVG, PNG_FILTER_PAETH };
+	ps_mt_data* mt = blk->mt;
+	int single = (mt->filters & (mt->filters - 1)) == 0;
+	png_const_bytep prev = blk->prev ? blk->prev : mt->zero_row;
+	png_bytep out = blk->in;
+
+	// Same heuristic libpng uses: pick the allowed filter with the minimum sum of absolute (signed) residuals.
+	for (png_uint_32 y = 0; y < blk->num_rows; y++) {
+		png_const_bytep row = blk->rows[y];
+		png_byte type = PNG_FILTER_VALUE_NONE;
+		size_t min = ~(size_t)0;
+
+		for (png_byte f = PNG_FILTER_VALUE_NONE; f < PNG_FILTER_VALUE_LAST; f++) {
+			if (!(mt->filters & masks[f]))
+				continue;
+
+			png_bytep dst = single ? out + 1 : blk->scratch;
+			size_t sum = filterRow(f, row, prev, dst, mt->rowbytes, mt->bpp);
+			if (sum < min) {
+				if (dst != out + 1)
+					memcpy(out + 1, dst, mt->rowbytes);
+
+				min = sum;
+				type = f;
+			}
+		}
+
+		out[0] = type;
+		out += mt->rowbytes + 1;
+		prev = row;
+	}
+
+	blk->in_len = (size_t)(out - blk->in);
+	blk->adler = adler32(1L, blk->in, (uInt)blk->in_len);
+	blk->status = Z_OK;
+}
+
+static void deflateBlock(ps_mt_block* blk) {
+	ps_mt_data* mt = blk->mt;
+	z_stream zs;
+	memset(&zs, 0, sizeof(z_stream));
+
+	blk->status = deflateInit2(&zs, mt->level, Z_DEFLATED, -15, ZLIB_MEM_LEVEL, mt->strategy);
+	if (blk->status != Z_OK)
+		return;
+
+	if (blk->dict_len > 0)
+		deflateSetDictionary(&zs, blk->dict, (uInt)blk->dict_len);
+
+	zs.next_in = blk->in;
+	zs.avail_in = (uInt)blk->in_len;
+	zs.next_out = blk->out;
+	zs.avail_out = (uInt)blk->out_size;
+
+	// Non-final blocks end with a sync flush so they are byte-aligned and can simply be concatenated.
+	int res = deflate(&zs, blk->last ? Z_FINISH : Z_SYNC_FLUSH);
+	if (blk->last ? res != Z_STREAM_END : (res != Z_OK || zs.avail_in != 0 || zs.avail_out == 0))
+		blk->status = Z_BUF_ERROR;
+
+	blk->out_len = blk->out_size - zs.avail_out;
+	deflateEnd(&zs);
+}
+
+static void* reallocBuffer(png_structp png_ptr, void* buff, size_t size) {
+	void* mem = realloc(buff, size);
+	if (!mem)
+		png_error(png_ptr, "Out of memory.");
+
+	return mem;
+}
+
+static void freeParallel(ps_mt_data* mt) {
+	if (!mt)
+		return;
+
+	for (int i = 0; i < MT_MAX_THREADS; i++) {
+		free(mt->blocks[i].in);
+		free(mt->blocks[i].out);
+	}
+
+	free(mt->stage);
+	free(mt->rows);
+	free(mt->zero_row);
+	free(mt->prev_row);
+	free(mt->scratch);
+	free(mt->dict);
+	free(mt);
+}
+
+static int startParallel(ps_png_struct* handle) {
+	png_structp png_ptr = handle->png_ptr;
+	ps_mt_data* mt = handle->mt_ptr;
+
+	if (mt->enabled >= 0)
+		return mt->enabled;
+
+	// Interlaced rows and APNG fdAT sequencing are left to libpng.
+	mt->enabled = mt->threads > 1 && !png_ptr->interlaced && png_ptr->num_frames_to_write == 0;
+	if (!mt->enabled)
+		return FALSE;
+
+	int palette = png_ptr->color_type == PNG_COLOR_TYPE_PALETTE;
+	mt->filters = png_ptr->do_filter ? png_ptr->do_filter : palette || png_ptr->bit_depth < 8 ? PNG_FILTER_NONE : PNG_ALL_FILTERS;
+	mt->level = png_ptr->zlib_level;
+	mt->strategy = mt->filters != PNG_FILTER_NONE ? Z_FILTERED : Z_DEFAULT_STRATEGY;
+	mt->rowbytes = PNG_ROWBYTES(png_ptr->pixel_depth, png_ptr->width);
+	mt->bpp = (png_ptr->pixel_depth + 7) >> 3;
+	mt->height = png_ptr->height;
+	mt->block_rows = (png_uint_32)(MT_BLOCK_SIZE / (mt->rowbytes + 1)) + 1;
+	if (mt->block_rows > mt->height)
+		mt->block_rows = mt->height;
+
+	size_t batch_rows = (size_t)mt->block_rows * mt->threads;
+	mt->stage = (png_bytep)reallocBuffer(png_ptr, NULL, batch_rows * mt->rowbytes);
+	mt->rows = (png_bytepp)reallocBuffer(png_ptr, NULL, batch_rows * sizeof(png_bytep));
+	mt->zero_row = (png_bytep)memset(reallocBuffer(png_ptr, NULL, mt->rowbytes), 0, mt->rowbytes);
+	mt->prev_row = (png_bytep)reallocBuffer(png_ptr, NULL, mt->rowbytes);
+	mt->scratch = (png_bytep)reallocBuffer(png_ptr, NULL, mt->rowbytes * mt->threads);
+	mt->dict = (png_bytep)reallocBuffer(png_ptr, NULL, MT_DICT_SIZE);
+	mt->dict_len = 0;
+	mt->adler = 1L;
+	mt->rows_done = 0;
+	mt->staged = 0;
+
+	return TRUE;
+}
+
+static void writeIdat(png_structp png_ptr, png_const_bytep pre, size_t pre_len, png_const_bytep data, size_t len, png_const_bytep post, size_t post_len) {
+	static const png_byte idat[] = { 73, 68, 65, 84 };
+
+	png_write_chunk_start(png_ptr, idat, (png_uint_32)(pre_len + len + post_len));
+	if (pre_len > 0)
+		png_write_chunk_data(png_ptr, pre, pre_len);
+	if (len > 0)
+		png_write_chunk_data(png_ptr, data, len);
+	if (post_len > 0)
+		png_write_chunk_data(png_ptr, post, post_len);
+	png_write_chunk_end(png_ptr);
+}
+
+static void flushParallel(ps_png_struct* handle) {
+	png_structp png_ptr = handle->png_ptr;
+	ps_mt_data* mt = handle->mt_ptr;
+	int last = mt->rows_done + mt->staged == mt->height;
+	int count = (int)((mt->staged + mt->block_rows - 1) / mt->block_rows);
+
+	for (int i = 0; i < count; i++) {
+		ps_mt_block* blk = &mt->blocks[i];
+		png_uint_32 first = (png_uint_32)i * mt->block_rows;
+
+		blk->mt = mt;
+		blk->rows = mt->rows + first;
+		blk->num_rows = mt->staged - first < mt->block_rows ? mt->staged - first : mt->block_rows;
+		blk->prev = first > 0 ? mt->rows[first - 1] : mt->rows_done > 0 ? mt->prev_row : NULL;
+		blk->scratch = mt->scratch + i * mt->rowbytes;
+		blk->last = last && i == count - 1;
+		blk->work = filterBlock;
+
+		size_t in_size = (size_t)blk->num_rows * (mt->rowbytes + 1);
+		if (in_size > blk->in_size) {
+			blk->in = (png_bytep)reallocBuffer(png_ptr, blk->in, in_size);
+			blk->in_size = in_size;
+		}
+
+		size_t out_size = compressBound((uLong)in_size) + 16;
+		if (out_size > blk->out_size) {
+			blk->out = (png_bytep)reallocBuffer(png_ptr, blk->out, out_size);
+			blk->out_size = out_size;
+		}
+	}
+
+	runParallel(mt->blocks, count);
+
+	// pigz-style: each block is primed with the last 32K of the previous block's filtered data.
+	mt->blocks[0].dict = mt->dict;
+	mt->blocks[0].dict_len = mt->dict_len;
+	mt->blocks[0].work = deflateBlock;
+
+	for (int i = 1; i < count; i++) {
+		ps_mt_block* blk = &mt->blocks[i];
+		ps_mt_block* prv = &mt->blocks[i - 1];
+
+		blk->dict_len = prv->in_len > MT_DICT_SIZE ? MT_DICT_SIZE : prv->in_len;
+		blk->dict = prv->in + prv->in_len - blk->dict_len;
+		blk->work = deflateBlock;
+	}
+
+	runParallel(mt->blocks, count);
+
+	for (int i = 0; i < count; i++) {
+		ps_mt_block* blk = &mt->blocks[i];
+		if (blk->status != Z_OK)
+			png_error(png_ptr, "Compression failed.");
+
+		png_byte head[2], tail[4];
+		size_t head_len = 0, tail_len = 0;
+
+		if (mt->rows_done == 0 && i == 0) {
+			int flevel = mt->level == Z_DEFAULT_COMPRESSION || mt->level == 6 ? 2 : mt->level < 2 ? 0 : mt->level < 6 ? 1 : 3;
+			head[0] = 0x78;
+			head[1] = (png_byte)(flevel << 6);
+			head[1] += (png_byte)(31 - ((head[0] << 8) + head[1]) % 31);
+			head_len = sizeof(head);
+		}
+
+		mt->adler = adler32_combine(mt->adler, blk->adler, (z_off_t)blk->in_len);
+		if (blk->last) {
+			png_save_uint_32(tail, (png_uint_32)mt->adler);
+			tail_len = sizeof(tail);
+		}
+
+		writeIdat(png_ptr, head, head_len, blk->out, blk->out_len, tail, tail_len);
+	}
+
+	ps_mt_block* end = &mt->blocks[count - 1];
+	mt->dict_len = end->in_len > MT_DICT_SIZE ? MT_DICT_SIZE : end->in_len;
+	memcpy(mt->dict, end->in + end->in_len - mt->dict_len, mt->dict_len);
+	memcpy(mt->prev_row, mt->rows[mt->staged - 1], mt->rowbytes);
+
+	png_ptr->mode |= PNG_HAVE_IDAT;
+	mt->rows_done += mt->staged;
+	mt->staged = 0;
+}
+
+static void stageRow(ps_png_struct* handle, png_const_bytep row, int copy) {
+	ps_mt_data* mt = handle->mt_ptr;
+
+	if (mt->rows_done + mt->staged >= mt->height)
+		png_error(handle->png_ptr, "Too many rows written.");
+
+	if (copy) {
+		png_bytep dst = mt->stage + mt->staged * mt->rowbytes;
+		memcpy(dst, row, mt->rowbytes);
+		row = dst;
+	}
+
+	mt->rows[mt->staged++] = (png_bytep)row;
+	if (mt->staged == mt->block_rows * (png_uint_32)mt->threads || mt->rows_done + mt->staged == mt->height)
+		flushParallel(handle);
+}
+
+static uint64_t ticks() {
+#ifdef _WIN32
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER count;
+	if (!freq.QuadPart)
+		QueryPerformanceFrequency(&freq);
+
+	QueryPerformanceCounter(&count);
+	return (uint64_t)(count.QuadPart / freq.QuadPart) * 1000000000 + (uint64_t)(count.QuadPart % freq.QuadPart) * 1000000000 / (uint64_t)freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// Charges an exported call to its stage whether or not it succeeded, so failed reads still show where time went.
+static void endStage(ps_png_struct* handle, int stage, uint64_t start, png_uint_32 rows) {
+	ps_png_stats* stats = &handle->io_ptr->stats;
+	stats->stage_ns[stage] += ticks() - start;
+	stats->rows += rows;
+}
+
+static size_t readCallback(ps_io_data* io, png_bytep data, size_t length) {
+	uint64_t start = ticks();
+	size_t cb = (*io->read_callback)(io->stream_handle, data, length);
+	io->stats.callback_ns += ticks() - start;
+	io->stats.read_calls++;
+	if (cb != ~0)
+		io->stats.bytes_in += cb;
+
+	return cb;
+}
+
+static size_t writeCallback(ps_io_data* io, png_bytep data, size_t length) {
+	uint64_t start = ticks();
+	size_t cb = (*io->write_callback)(io->stream_handle, data, length);
+	io->stats.callback_ns += ticks() - start;
+	io->stats.write_calls++;
+	if (cb == length)
+		io->stats.bytes_out += cb;
+
+	return cb;
+}
+
+static size_t seekCallback(ps_io_data* io, size_t pos) {
+	uint64_t start = ticks();
+	size_t cb = (*io->seek_callback)(io->stream_handle, pos);
+	io->stats.callback_ns += ticks() - start;
+	io->stats.seek_calls++;
+
+	return cb;
+}
+
+static png_bytep ensureBuffer(png_structp png_ptr, ps_io_data* io, size_t size) {
+	if (size > io->buff_size || !io->buff) {
+		png_bytep buff = (png_bytep)realloc(io->buff, size);
+		if (!buff)
+			png_error(png_ptr, "Out of memory.");
+
+		io->buff = buff;
+		io->buff_size = size;
+	}
+
+	return io->buff;
+}
+
+static void flushData(png_structp png_ptr, ps_io_data* io) {
+	if (io->buff_len > 0 && writeCallback(io, io->buff, io->buff_len) != io->buff_len)
+		png_error(png_ptr, "Write failed.");
+
+	io->buff_len = 0;
+}
+
 static void writeData(png_structp png_ptr, png_bytep data, size_t length) {
 	ps_io_data* client = (ps_io_data*)png_get_io_ptr(png_ptr);
 
-	if ((*client->write_callback)(client->stream_handle, data, length) != length)
-		png_error(png_ptr, "Write failed.");
+	if (client->buff_len + length > client->buff_size) {
+		flushData(png_ptr, client);
+
+		if (length >= client->buff_size) {
+			if (writeCallback(client, data, length) != length)
+				png_error(png_ptr, "Write failed.");
+
+			return;
+		}
+	}
+
+	memcpy(ensureBuffer(png_ptr, client, client->buff_size) + client->buff_len, data, length);
+	client->buff_len += length;
+}
+
+static void writeMemData(png_structp png_ptr, png_bytep data, size_t length) {
+	ps_io_data* client = (ps_io_data*)png_get_io_ptr(png_ptr);
+	size_t size = client->buff_size > IO_BUF_SIZE ? client->buff_size : IO_BUF_SIZE;
+
+	while (size < client->buff_len + length)
+		size *= 2;
+
+	memcpy(ensureBuffer(png_ptr, client, size) + client->buff_len, data, length);
+	client->buff_len += length;
+	client->stats.bytes_out += length;
 }
 
 static void readData(png_structp png_ptr, png_bytep data, size_t length) {
 	ps_io_data* client = (ps_io_data*)png_get_io_ptr(png_ptr);
+	client->read_pos += length;
+
+	while (length > 0) {
+		size_t cb = client->buff_len - client->buff_pos;
+		if (cb == 0) {
+			// Large reads (e.g. IDAT) go straight to the caller's buffer; small ones are staged to save callbacks.
+			if (length >= client->buff_size) {
+				if (readCallback(client, data, length) != length)
+					png_error(png_ptr, "Read failed.");
+
+				client->buff_len = client->buff_pos = 0;
+				return;
+			}
+
+			cb = readCallback(client, ensureBuffer(png_ptr, client, client->buff_size), client->buff_size);
+			if (cb == 0 || cb == ~0)
+				png_error(png_ptr, "Read failed.");
+
+			client->buff_len = cb;
+			client->buff_pos = 0;
+		}
+
+		if (cb > length)
+			cb = length;
+
+		memcpy(data, client->buff + client->buff_pos, cb);
+		client->buff_pos += cb;
+		data += cb;
+		length -= cb;
+	}
+}
+
+static void readMemData(png_structp png_ptr, png_bytep data, size_t length) {
+	ps_io_data* client = (ps_io_data*)png_get_io_ptr(png_ptr);
 
-	if ((*client->read_callback)(client->stream_handle, data, length) != length)
+	if (length > client->mem_len - client->mem_pos)
 		png_error(png_ptr, "Read failed.");
+
+	memcpy(data, client->mem + client->mem_pos, length);
+	client->mem_pos += length;
+	client->stats.bytes_in += length;
+}
+
+static size_t tellData(ps_io_data* io) {
+	return io->mem ? io->mem_pos : io->read_pos;
+}
+
+static void seekData(png_structp png_ptr, ps_io_data* io, size_t pos) {
+	if (io->mem) {
+		if (pos > io->mem_len)
+			png_error(png_ptr, "Seek failed.");
+
+		io->mem_pos = pos;
+		return;
+	}
+
+	// Stay within the staging buffer if it still holds the target.
+	size_t start = io->read_pos - io->buff_pos;
+	if (pos >= start && pos - start <= io->buff_len) {
+		io->buff_pos = pos - start;
+		io->read_pos = pos;
+		return;
+	}
+
+	if (!io->seek_callback || seekCallback(io, pos) != pos)
+		png_error(png_ptr, "Seek failed.");
+
+	io->buff_len = io->buff_pos = 0;
+	io->read_pos = pos;
+}
+
+static void resetReadStruct(png_structp png_ptr, png_infop info_ptr) {
+	// Returns the read struct to the state png_create_read_struct_2 leaves it in, without releasing the memory
+	// that is sized per image and reallocated on demand.  The zlib stream is kept initialized, so the next
+	// png_inflate_claim does an inflateReset2 rather than reallocating the inflate state and window.
+	png_free_data(png_ptr, info_ptr, PNG_FREE_ALL, -1);
+	memset(info_ptr, 0, sizeof(*info_ptr));
+
+#ifdef PNG_READ_GAMMA_SUPPORTED
+	png_destroy_gamma_table(png_ptr);
+#endif
+#ifdef PNG_READ_QUANTIZE_SUPPORTED
+	png_free(png_ptr, png_ptr->palette_lookup);
+	png_free(png_ptr, png_ptr->quantize_index);
+#endif
+	if (png_ptr->free_me & PNG_FREE_PLTE)
+		png_free(png_ptr, png_ptr->palette);
+#if defined(PNG_tRNS_SUPPORTED) || defined(PNG_READ_EXPAND_SUPPORTED) || defined(PNG_READ_BACKGROUND_SUPPORTED)
+	if (png_ptr->free_me & PNG_FREE_TRNS)
+		png_free(png_ptr, png_ptr->trans_alpha);
+#endif
+#ifdef PNG_PROGRESSIVE_READ_SUPPORTED
+	png_free(png_ptr, png_ptr->save_buffer);
+#endif
+#ifdef PNG_READ_UNKNOWN_CHUNKS_SUPPORTED
+	png_free(png_ptr, png_ptr->unknown_chunk.data);
+#endif
+#ifdef PNG_SET_UNKNOWN_CHUNKS_SUPPORTED
+	png_free(png_ptr, png_ptr->chunk_list);
+#endif
+#if defined(PNG_READ_EXPAND_SUPPORTED) && defined(PNG_ARM_NEON_IMPLEMENTATION)
+	png_free(png_ptr, png_ptr->riffled_palette);
+#endif
+
+	png_struct keep = *png_ptr;
+	memset(png_ptr, 0, sizeof(*png_ptr));
+
+#ifdef PNG_USER_LIMITS_SUPPORTED
+	png_ptr->user_width_max = keep.user_width_max;
+	png_ptr->user_height_max = keep.user_height_max;
+	png_ptr->user_chunk_cache_max = keep.user_chunk_cache_max;
+	png_ptr->user_chunk_malloc_max = keep.user_chunk_malloc_max;
+#endif
+	png_ptr->mem_ptr = keep.mem_ptr;
+	png_ptr->malloc_fn = keep.malloc_fn;
+	png_ptr->free_fn = keep.free_fn;
+	png_ptr->error_ptr = keep.error_ptr;
+	png_ptr->error_fn = keep.error_fn;
+	png_ptr->warning_fn = keep.warning_fn;
+
+	png_ptr->zstream = keep.zstream;
+	png_ptr->flags = keep.flags & PNG_FLAG_ZSTREAM_INITIALIZED;
+	png_ptr->big_row_buf = keep.big_row_buf;
+	png_ptr->big_prev_row = keep.big_prev_row;
+	png_ptr->row_buf = keep.row_buf;
+	png_ptr->prev_row = keep.prev_row;
+	png_ptr->old_big_row_buf_size = keep.old_big_row_buf_size;
+	png_ptr->read_buffer = keep.read_buffer;
+	png_ptr->read_buffer_size = keep.read_buffer_size;
+
+	png_ptr->mode = PNG_IS_READ_STRUCT;
+	png_ptr->IDAT_read_size = PNG_IDAT_READ_SIZE;
+#ifdef PNG_BENIGN_READ_ERRORS_SUPPORTED
+	png_ptr->flags |= PNG_FLAG_BENIGN_ERRORS_WARN;
+#if PNG_RELEASE_BUILD
+	png_ptr->flags |= PNG_FLAG_APP_WARNINGS_WARN;
+#endif
+#endif
+}
+
+// Row index, after zran: a checkpoint is taken at a deflate block boundary roughly every `spacing` bytes of filtered
+// image data.  Each one holds the compressed position (file offset, unused bits of the previous byte and the bytes
+// left in that IDAT chunk), the 32K inflate window, and the unfiltered row before the first row that starts after the
+// checkpoint.  The index is kept in its serialized form, with all fields big-endian:
+//
+//   header: "psix", version, width, height, pixel_depth, count, idat_len, reserved, idat_pos (8)
+//   entry:  in_pos (8), out_pos (8), idat_left, bits, byte, reserved (2), window_len, reserved, window (32K), row
+#define IDX_VERSION 1
+#define IDX_HEAD_SIZE 40
+#define IDX_ENTRY_HEAD_SIZE 32
+#define IDX_WINDOW_SIZE (1 << 15)
+#ifndef IDX_IN_SIZE
+#define IDX_IN_SIZE (1 << 15)
+#endif
+#define IDX_DEFAULT_SPACING (1 << 20)
+
+struct ps_png_index {
+	size_t idat_pos;
+	png_uint_32 idat_len;
+	png_bytep data;
+	size_t len;
+	size_t size;
+	png_bytep in;
+	png_bytep row;
+	png_bytep prev;
+	png_byte in_last;
+	z_stream zs;
+	int zinit;
+};
+
+static void saveSize(png_bytep buf, size_t val) {
+	png_save_uint_32(buf, (png_uint_32)((uint64_t)val >> 32));
+	png_save_uint_32(buf + 4, (png_uint_32)val);
+}
+
+static size_t loadSize(png_const_bytep buf) {
+	uint64_t val = (uint64_t)png_get_uint_32(buf) << 32 | png_get_uint_32(buf + 4);
+	return val > SIZE_MAX ? SIZE_MAX : (size_t)val;
+}
+
+static size_t indexRowBytes(png_structp png_ptr) {
+	return PNG_ROWBYTES(png_ptr->pixel_depth, png_ptr->width);
+}
+
+static size_t indexEntrySize(png_structp png_ptr) {
+	return IDX_ENTRY_HEAD_SIZE + IDX_WINDOW_SIZE + indexRowBytes(png_ptr);
+}
+
+static png_uint_32 indexCount(ps_png_index* idx) {
+	return idx->len ? png_get_uint_32(idx->data + 20) : 0;
+}
+
+static void freeIndexScratch(ps_png_index* idx) {
+	if (idx->zinit)
+		inflateEnd(&idx->zs);
+
+	free(idx->in);
+	free(idx->row);
+	free(idx->prev);
+	idx->in = idx->row = idx->prev = NULL;
+	idx->zinit = FALSE;
+}
+
+static void freeIndex(ps_png_index* idx) {
+	if (!idx)
+		return;
+
+	freeIndexScratch(idx);
+	free(idx->data);
+	free(idx);
+}
+
+static void abortIndex(ps_png_index* idx) {
+	// A pre-pass that fails part way leaves a partial index, which must not be used.
+	if (idx && idx->zinit) {
+		freeIndexScratch(idx);
+		idx->len = 0;
+	}
+}
+
+static void checkIndexable(png_structp png_ptr, ps_png_index* idx) {
+	// Only the IDAT stream is indexed, so APNG fdAT frames and Adam7 passes are left to sequential decoding.
+	if (!idx || png_ptr->chunk_name != png_IDAT)
+		png_error(png_ptr, "Row index is only available for the IDAT image.");
+
+	if (png_ptr->interlaced)
+		png_error(png_ptr, "Row index is not supported for interlaced images.");
+}
+
+static void addCheckpoint(png_structp png_ptr, ps_png_index* idx, size_t in_pos, png_uint_32 idat_left, size_t out_pos) {
+	size_t entry_size = indexEntrySize(png_ptr);
+	if (idx->len + entry_size > idx->size) {
+		size_t size = idx->size ? idx->size * 2 : IDX_HEAD_SIZE + entry_size * 8;
+		while (size < idx->len + entry_size)
+			size *= 2;
+
+		idx->data = (png_bytep)reallocBuffer(png_ptr, idx->data, size);
+		idx->size = size;
+	}
+
+	png_bytep entry = idx->data + idx->len;
+	memset(entry, 0, IDX_ENTRY_HEAD_SIZE);
+
+	int bits = idx->zs.data_type & 7;
+	saveSize(entry, in_pos);
+	saveSize(entry + 8, out_pos);
+	png_save_uint_32(entry + 16, idat_left);
+	entry[20] = (png_byte)bits;
+	// The pending bits belong to the last byte inflate consumed.  That is normally the one before next_in, but inflate
+	// can report a boundary from bits it already holds right after a refill, when it is the last byte of the old buffer.
+	entry[21] = bits ? idx->zs.next_in > idx->in ? idx->zs.next_in[-1] : idx->in_last : 0;
+
+	uInt wlen = IDX_WINDOW_SIZE;
+	if (inflateGetDictionary(&idx->zs, entry + IDX_ENTRY_HEAD_SIZE, &wlen) != Z_OK)
+		png_error(png_ptr, "Decompression failed.");
+
+	png_save_uint_32(entry + 24, wlen);
+
+	png_save_uint_32(idx->data + 20, indexCount(idx) + 1);
+	idx->len += entry_size;
+}
+
+static void buildIndex(ps_png_struct* handle, size_t spacing) {
+	png_structp png_ptr = handle->png_ptr;
+	ps_png_index* idx = handle->index_ptr;
+	checkIndexable(png_ptr, idx);
+
+	size_t rowbytes = indexRowBytes(png_ptr);
+	size_t row_size = rowbytes + 1;
+	size_t entry_size = indexEntrySize(png_ptr);
+	size_t resume = tellData(handle->io_ptr);
+
+	// Checkpoints closer than a row apart buy nothing, and this guarantees at most one is waiting for its row.
+	if (spacing < row_size)
+		spacing = row_size;
+
+	idx->len = 0;
+	idx->data = (png_bytep)reallocBuffer(png_ptr, idx->data, idx->size > IDX_HEAD_SIZE ? idx->size : IDX_HEAD_SIZE);
+	idx->size = idx->size > IDX_HEAD_SIZE ? idx->size : IDX_HEAD_SIZE;
+	memcpy(idx->data, "psix", 4);
+	png_save_uint_32(idx->data + 4, IDX_VERSION);
+	png_save_uint_32(idx->data + 8, png_ptr->width);
+	png_save_uint_32(idx->data + 12, png_ptr->height);
+	png_save_uint_32(idx->data + 16, png_ptr->pixel_depth);
+	png_save_uint_32(idx->data + 20, 0);
+	png_save_uint_32(idx->data + 24, idx->idat_len);
+	png_save_uint_32(idx->data + 28, 0);
+	saveSize(idx->data + 32, idx->idat_pos);
+	idx->len = IDX_HEAD_SIZE;
+
+	freeIndexScratch(idx);
+	idx->in = (png_bytep)reallocBuffer(png_ptr, NULL, IDX_IN_SIZE);
+	idx->row = (png_bytep)reallocBuffer(png_ptr, NULL, row_size);
+	idx->prev = (png_bytep)memset(reallocBuffer(png_ptr, NULL, row_size), 0, row_size);
+
+	memset(&idx->zs, 0, sizeof(z_stream));
+	if (inflateInit(&idx->zs) != Z_OK)
+		png_error(png_ptr, "Decompression failed.");
+
+	idx->zinit = TRUE;
+	seekData(png_ptr, handle->io_ptr, idx->idat_pos);
+
+	z_stream* zs = &idx->zs;
+	size_t pos = idx->idat_pos, last = 0;
+	png_uint_32 left = idx->idat_len, rows = 0;
+	png_bytep pending = NULL;
+
+	zs->next_out = idx->row;
+	zs->avail_out = (uInt)row_size;
+
+	while (rows < png_ptr->height) {
+		if (zs->avail_in == 0) {
+			while (left == 0) {
+				png_byte head[12];
+				png_read_data(png_ptr, head, sizeof(head));
+				if (PNG_U32(head[8], head[9], head[10], head[11]) != png_IDAT)
+					png_error(png_ptr, "Not enough image data.");
+
+				left = png_get_uint_31(png_ptr, head + 4);
+				pos += sizeof(head);
+			}
+
+			if (zs->next_in)
+				idx->in_last = zs->next_in[-1];
+
+			uInt cb = left < IDX_IN_SIZE ? left : IDX_IN_SIZE;
+			png_read_data(png_ptr, idx->in, cb);
+			zs->next_in = idx->in;
+			zs->avail_in = cb;
+			left -= cb;
+			pos += cb;
+		}
+
+		int ret = inflate(zs, Z_BLOCK);
+		if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+			png_error(png_ptr, zs->msg ? zs->msg : "Decompression failed.");
+
+		if (zs->avail_out == 0) {
+			png_byte filter = idx->row[0];
+			if (filter >= PNG_FILTER_VALUE_LAST)
+				png_error(png_ptr, "bad adaptive filter value");
+
+			if (filter > PNG_FILTER_VALUE_NONE) {
+				png_row_info row_info;
+				row_info.width = png_ptr->width;
+				row_info.rowbytes = rowbytes;
+				row_info.pixel_depth = png_ptr->pixel_depth;
+				png_read_filter_row(png_ptr, &row_info, idx->row + 1, idx->prev + 1, filter);
+			}
+
+			png_bytep tmp = idx->prev;
+			idx->prev = idx->row;
+			idx->row = tmp;
+			rows++;
+
+			if (pending) {
+				memcpy(pending + IDX_ENTRY_HEAD_SIZE + IDX_WINDOW_SIZE, idx->prev + 1, rowbytes);
+				pending = NULL;
+			}
+
+			zs->next_out = idx->row;
+			zs->avail_out = (uInt)row_size;
+		}
+
+		if (ret == Z_STREAM_END)
+			break;
+
+		// Stopped at a block boundary (not the last block): the stream can be restarted here with only the window.
+		size_t out = (size_t)rows * row_size + (row_size - zs->avail_out);
+		if ((zs->data_type & 128) && !(zs->data_type & 64) && (indexCount(idx) == 0 || out - last >= spacing)) {
+			addCheckpoint(png_ptr, idx, pos - zs->avail_in, left + zs->avail_in, out);
+			last = out;
+
+			// The row needed to unfilter the first full row after this point is either done or still being inflated.
+			png_bytep entry = idx->data + idx->len - entry_size;
+			if (out == (size_t)rows * row_size)
+				memcpy(entry + IDX_ENTRY_HEAD_SIZE + IDX_WINDOW_SIZE, idx->prev + 1, rowbytes);
+			else
+				pending = entry;
+		}
+	}
+
+	// An unfinished row at the end of a truncated stream leaves no valid successor, so its checkpoint goes.
+	if (pending) {
+		png_save_uint_32(idx->data + 20, indexCount(idx) - 1);
+		idx->len -= entry_size;
+	}
+
+	freeIndexScratch(idx);
+	seekData(png_ptr, handle->io_ptr, resume);
+}
+
+static void seekRow(ps_png_struct* handle, png_uint_32 row) {
+	png_structp png_ptr = handle->png_ptr;
+	ps_png_index* idx = handle->index_ptr;
+	checkIndexable(png_ptr, idx);
+
+	if (row >= png_ptr->height)
+		png_error(png_ptr, "Row out of range.");
+
+	if (!(png_ptr->flags & PNG_FLAG_ROW_INIT))
+		png_read_start_row(png_ptr);
+
+	if (indexCount(idx) == 0)
+		buildIndex(handle, IDX_DEFAULT_SPACING);
+
+	size_t row_size = indexRowBytes(png_ptr) + 1;
+	size_t entry_size = indexEntrySize(png_ptr);
+	png_uint_32 count = indexCount(idx);
+
+	// Find the last checkpoint whose first full row is at or before the target.
+	png_uint_32 lo = 0, hi = count;
+	while (hi - lo > 1) {
+		png_uint_32 mid = lo + (hi - lo) / 2;
+		size_t out = loadSize(idx->data + IDX_HEAD_SIZE + mid * entry_size + 8);
+		if ((out + row_size - 1) / row_size <= row)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	png_const_bytep entry = idx->data + IDX_HEAD_SIZE + lo * entry_size;
+	size_t out = loadSize(entry + 8);
+	png_uint_32 first = (png_uint_32)((out + row_size - 1) / row_size);
+
+	// Reading forward is cheaper when the decoder is already between the checkpoint and the target.
+	int active = png_ptr->zowner == png_IDAT && !(png_ptr->flags & PNG_FLAG_ZSTREAM_ENDED);
+	if (!active || png_ptr->row_number > row || png_ptr->row_number < first) {
+		if (!(png_ptr->flags & PNG_FLAG_ZSTREAM_INITIALIZED))
+			png_error(png_ptr, "Decompression not started.");
+
+		seekData(png_ptr, handle->io_ptr, loadSize(entry));
+
+		// The checkpoint is a raw deflate position; the zlib trailer is never reached and is ignored anyway.
+		z_streamp zs = &png_ptr->zstream;
+		int bits = entry[20];
+		if (inflateReset2(zs, -15) != Z_OK ||
+			(bits && inflatePrime(zs, bits, entry[21] >> (8 - bits)) != Z_OK) ||
+			inflateSetDictionary(zs, entry + IDX_ENTRY_HEAD_SIZE, png_get_uint_32(entry + 24)) != Z_OK)
+			png_error(png_ptr, "Decompression failed.");
+
+		zs->next_in = NULL;
+		zs->avail_in = 0;
+
+		png_ptr->idat_size = png_get_uint_32(entry + 16);
+		png_ptr->zowner = png_IDAT;
+		png_ptr->mode = (png_ptr->mode | PNG_HAVE_IDAT) & ~PNG_AFTER_IDAT;
+		png_ptr->flags &= ~PNG_FLAG_ZSTREAM_ENDED;
+		png_ptr->row_number = first;
+
+		png_ptr->prev_row[0] = 0;
+		memcpy(png_ptr->prev_row + 1, entry + IDX_ENTRY_HEAD_SIZE + IDX_WINDOW_SIZE, row_size - 1);
+
+		size_t skip = (size_t)first * row_size - out;
+		if (skip > 0)
+			png_read_IDAT_data(png_ptr, png_ptr->row_buf, skip);
+	}
+
+	while (png_ptr->row_number < row)
+		png_read_row(png_ptr, NULL, NULL);
+}
+
+static void setIndex(ps_png_struct* handle, png_const_bytep data, size_t len) {
+	png_structp png_ptr = handle->png_ptr;
+	ps_png_index* idx = handle->index_ptr;
+	checkIndexable(png_ptr, idx);
+
+	size_t row_size = indexRowBytes(png_ptr) + 1;
+	size_t entry_size = indexEntrySize(png_ptr);
+
+	// The header ties the index to this image's layout and IDAT position; entries are range-checked so a bad index
+	// can only cause a decode error.
+	if (len < IDX_HEAD_SIZE || memcmp(data, "psix", 4) ||
+		png_get_uint_32(data + 4) != IDX_VERSION ||
+		png_get_uint_32(data + 8) != png_ptr->width ||
+		png_get_uint_32(data + 12) != png_ptr->height ||
+		png_get_uint_32(data + 16) != png_ptr->pixel_depth ||
+		png_get_uint_32(data + 24) != idx->idat_len ||
+		loadSize(data + 32) != idx->idat_pos)
+		png_error(png_ptr, "Row index does not match image.");
+
+	png_uint_32 count = png_get_uint_32(data + 20);
+	if (count == 0 || (len - IDX_HEAD_SIZE) / entry_size != count || (len - IDX_HEAD_SIZE) % entry_size)
+		png_error(png_ptr, "Invalid row index.");
+
+	for (png_uint_32 i = 0; i < count; i++) {
+		png_const_bytep entry = data + IDX_HEAD_SIZE + i * entry_size;
+		if (loadSize(entry + 8) > (size_t)png_ptr->height * row_size || entry[20] > 7 || png_get_uint_32(entry + 24) > IDX_WINDOW_SIZE)
+			png_error(png_ptr, "Invalid row index.");
+	}
+
+	if (len > idx->size) {
+		idx->data = (png_bytep)reallocBuffer(png_ptr, idx->data, len);
+		idx->size = len;
+	}
+
+	memcpy(idx->data, data, len);
+	idx->len = len;
+}
+
+// Once Adam7 passes 1..n are read, every pixel on a grid spaced by the next pass's column and row spacing is known.
+// That grid is the 1/8, 1/4 or 1/2 scale image after 1, 3 or 5 passes, and 2, 4 or 6 passes give the in-between
+// anisotropic sizes.
+#define PASS_X_SHIFT(n) ((n) < PNG_INTERLACE_ADAM7_PASSES ? PNG_PASS_COL_SHIFT(n) : 0)
+#define PASS_Y_SHIFT(n) ((n) < PNG_INTERLACE_ADAM7_PASSES ? PNG_PASS_ROW_SHIFT(n) : 0)
+
+static void readPasses(ps_png_struct* handle, int passes, png_bytepp image) {
+	png_structp png_ptr = handle->png_ptr;
+	if (!png_ptr->interlaced)
+		png_error(png_ptr, "Image is not interlaced.");
+	if (passes < 1 || passes > PNG_INTERLACE_ADAM7_PASSES)
+		png_error(png_ptr, "Invalid pass count.");
+	if (!(png_ptr->flags & PNG_FLAG_ROW_INIT))
+		png_error(png_ptr, "Read info has not been updated.");
+	if (png_ptr->pass || png_ptr->row_number)
+		png_error(png_ptr, "Rows have already been read.");
+
+	size_t bpp = handle->info_ptr->pixel_depth >> 3;
+	if (bpp == 0)
+		png_error(png_ptr, "Pass reads require at least 8 bits per pixel.");
+
+	// Take the passes as packed sub-image rows instead of letting libpng spread each one across a full-width row.
+	// With the interlace transform off, png_read_finish_row sizes the following passes itself.
+	png_ptr->transformations &= ~PNG_INTERLACE;
+	png_ptr->num_rows = PNG_PASS_ROWS(png_ptr->height, 0);
+
+	int xshift = PASS_X_SHIFT(passes);
+	int yshift = PASS_Y_SHIFT(passes);
+	while (png_ptr->pass < passes) {
+		int pass = png_ptr->pass;
+		png_uint_32 width = png_ptr->iwidth;
+		png_bytep out = image[PNG_ROW_FROM_PASS_ROW(png_ptr->row_number, pass) >> yshift] + (PNG_PASS_START_COL(pass) >> xshift) * bpp;
+
+		// The transformed row is left in row_buf, so there is no need for a full-width scratch row.
+		png_read_row(png_ptr, NULL, NULL);
+
+		png_const_bytep in = png_ptr->row_buf + 1;
+		size_t step = ((size_t)1 << (PNG_PASS_COL_SHIFT(pass) - xshift)) * bpp;
+		if (step == bpp) {
+			memcpy(out, in, width * bpp);
+			continue;
+		}
+
+		for (png_uint_32 x = 0; x < width; x++, in += bpp, out += step)
+			memcpy(out, in, bpp);
+	}
+
+	// Leave the remaining passes compressed.  Marking the stream ended lets png_read_end skip the rest of the IDAT
+	// data without inflating it.
+	png_ptr->flags |= PNG_FLAG_ZSTREAM_ENDED;
+	png_ptr->mode |= PNG_AFTER_IDAT;
 }
 
 static int setupRead(png_structp png_ptr, png_infop info_ptr, ps_png_struct* handle, ps_error_data* err, ps_io_data* io) {
 	handle->png_ptr = png_ptr;
 	handle->info_ptr = info_ptr;
 	handle->io_ptr = io;
+	handle->mt_ptr = NULL;
 
 	png_set_error_fn(png_ptr, err, throwError, NULL);
-	png_set_read_fn(png_ptr, io, readData);
+	png_set_read_fn(png_ptr, io, io->mem ? readMemData : readData);
 
 	TRY {
 		png_set_option(png_ptr, PNG_IGNORE_ADLER32, PNG_OPTION_ON);
@@ -68,7 +1202,19 @@ png_uint_32 PngVersion() {
 }
 
 ps_png_struct* PngCreateWrite() {
-	png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	return PngCreateWriteWithAllocator(NULL, 0);
+}
+
+ps_png_struct* PngCreateRead() {
+	return PngCreateReadWithAllocator(NULL, 0);
+}
+
+ps_png_struct* PngCreateWriteWithAllocator(const ps_allocator* allocator, size_t retain) {
+	ps_arena* arena = allocator || retain ? createArena(allocator, retain) : NULL;
+	if ((allocator || retain) && !arena)
+		return NULL;
+
+	png_structp png_ptr = png_create_write_struct_2(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL, arena, arena ? pngAlloc : NULL, arena ? pngFree : NULL);
 
 	ps_png_struct* handle = (ps_png_struct*)malloc(sizeof(ps_png_struct));
 	ps_error_data* err = (ps_error_data*)malloc(sizeof(ps_error_data));
@@ -78,16 +1224,22 @@ ps_png_struct* PngCreateWrite() {
 		free(io);
 		free(err);
 		free(handle);
-		free(png_ptr);
+		png_destroy_write_struct(&png_ptr, NULL);
+		destroyArena(arena);
 		return NULL;
 	}
 
 	handle->png_ptr = png_ptr;
 	handle->info_ptr = NULL;
 	handle->io_ptr = io;
+	handle->mt_ptr = NULL;
+	handle->index_ptr = NULL;
+
+	memset(io, 0, sizeof(ps_io_data));
+	io->buff_size = IO_BUF_SIZE;
 
 	png_set_error_fn(png_ptr, memset(err, 0, sizeof(ps_error_data)), throwError, NULL);
-	png_set_write_fn(png_ptr, memset(io, 0, sizeof(ps_io_data)), writeData, NULL);
+	png_set_write_fn(png_ptr, io, writeData, NULL);
 
 	TRY {
 		png_set_option(png_ptr, PNG_SKIP_sRGB_CHECK_PROFILE, PNG_OPTION_ON);
@@ -99,8 +1251,12 @@ ps_png_struct* PngCreateWrite() {
 	}
 }
 
-ps_png_struct* PngCreateRead() {
-	png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+ps_png_struct* PngCreateReadWithAllocator(const ps_allocator* allocator, size_t retain) {
+	ps_arena* arena = allocator || retain ? createArena(allocator, retain) : NULL;
+	if ((allocator || retain) && !arena)
+		return NULL;
+
+	png_structp png_ptr = png_create_read_struct_2(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL, arena, arena ? pngAlloc : NULL, arena ? pngFree : NULL);
 	png_infop info_ptr = png_create_info_struct(png_ptr);
 
 	ps_png_struct* handle = (ps_png_struct*)malloc(sizeof(ps_png_struct));
@@ -111,13 +1267,15 @@ ps_png_struct* PngCreateRead() {
 		free(io);
 		free(err);
 		free(handle);
-		free(info_ptr);
-		free(png_ptr);
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		destroyArena(arena);
 		return NULL;
 	}
 
 	memset(err, 0, sizeof(ps_error_data));
 	memset(io, 0, sizeof(ps_io_data));
+	io->buff_size = IO_BUF_SIZE;
+	handle->index_ptr = NULL;
 
 	if (setupRead(png_ptr, info_ptr, handle, err, io))
 		return handle;
@@ -127,35 +1285,44 @@ ps_png_struct* PngCreateRead() {
 }
 
 int PngResetRead(ps_png_struct* handle) {
-	png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-	png_infop info_ptr = png_create_info_struct(png_ptr);
+	ps_io_data* io = handle->io_ptr;
+	ps_error_data* err = (ps_error_data*)png_get_error_ptr(handle->png_ptr);
 
-	if (!png_ptr || !info_ptr) {
-		free(png_ptr);
-		free(info_ptr);
-		return FALSE;
-	}
+	resetReadStruct(handle->png_ptr, handle->info_ptr);
 
-	ps_io_data* io = (ps_io_data*)png_get_io_ptr(handle->png_ptr);
-	ps_error_data* err = (ps_error_data*)png_get_error_ptr(handle->png_ptr);
-	png_destroy_read_struct(&handle->png_ptr, &handle->info_ptr, NULL);
+	io->buff_len = io->buff_pos = 0;
+	io->read_pos = io->mem_pos = 0;
+
+	if (handle->index_ptr)
+		handle->index_ptr->len = 0;
+	err->error_msg[0] = '\0';
 
-	return setupRead(png_ptr, info_ptr, handle, err, io);
+	return setupRead(handle->png_ptr, handle->info_ptr, handle, err, io);
 }
 
 void PngDestroyWrite(ps_png_struct* handle) {
+	ps_arena* arena = (ps_arena*)png_get_mem_ptr(handle->png_ptr);
+
+	freeParallel(handle->mt_ptr);
+	free(handle->io_ptr->buff);
 	free(png_get_io_ptr(handle->png_ptr));
 	free(png_get_error_ptr(handle->png_ptr));
 	png_destroy_write_struct(&handle->png_ptr, NULL);
+	destroyArena(arena);
 
 	memset(handle, 0, sizeof(ps_png_struct));
 	free(handle);
 }
 
 void PngDestroyRead(ps_png_struct* handle) {
+	ps_arena* arena = (ps_arena*)png_get_mem_ptr(handle->png_ptr);
+
+	freeIndex(handle->index_ptr);
+	free(handle->io_ptr->buff);
 	free(png_get_io_ptr(handle->png_ptr));
 	free(png_get_error_ptr(handle->png_ptr));
 	png_destroy_read_struct(&handle->png_ptr, &handle->info_ptr, NULL);
+	destroyArena(arena);
 
 	memset(handle, 0, sizeof(ps_png_struct));
 	free(handle);
@@ -165,6 +1332,57 @@ const char* PngGetLastError(ps_png_struct* handle) {
 	return ((ps_error_data*)png_get_error_ptr(handle->png_ptr))->error_msg;
 }
 
+void PngGetStats(ps_png_struct* handle, ps_png_stats* stats) {
+	*stats = handle->io_ptr->stats;
+}
+
+void PngResetStats(ps_png_struct* handle) {
+	memset(&handle->io_ptr->stats, 0, sizeof(ps_png_stats));
+}
+
+int PngSetBufferSize(ps_png_struct* handle, size_t size) {
+	TRY {
+		ps_io_data* io = handle->io_ptr;
+		if (io->buff_len > 0 || io->mem_dest)
+			png_error(handle->png_ptr, "Buffer size cannot be changed after I/O has started.");
+
+		free(io->buff);
+		io->buff = NULL;
+		io->buff_size = size;
+	}
+	return TRY_RESULT;
+}
+
+int PngSetMemorySource(ps_png_struct* handle, png_const_bytep buff, size_t len) {
+	TRY {
+		ps_io_data* io = handle->io_ptr;
+		if (io->buff_len > 0 || io->mem_pos > 0)
+			png_error(handle->png_ptr, "Memory source cannot be changed after I/O has started.");
+
+		io->mem = buff;
+		io->mem_len = buff ? len : 0;
+		png_set_read_fn(handle->png_ptr, io, buff ? readMemData : readData);
+	}
+	return TRY_RESULT;
+}
+
+int PngSetMemoryDest(ps_png_struct* handle) {
+	TRY {
+		ps_io_data* io = handle->io_ptr;
+		if (io->buff_len > 0)
+			png_error(handle->png_ptr, "Memory destination cannot be set after I/O has started.");
+
+		io->mem_dest = TRUE;
+		png_set_write_fn(handle->png_ptr, io, writeMemData, NULL);
+	}
+	return TRY_RESULT;
+}
+
+void PngGetMemoryDest(ps_png_struct* handle, png_const_bytep* buff, size_t* len) {
+	*buff = handle->io_ptr->buff;
+	*len = handle->io_ptr->buff_len;
+}
+
 int PngSetFilter(ps_png_struct* handle, int filters) {
 	TRY png_set_filter(handle->png_ptr, PNG_FILTER_TYPE_DEFAULT, filters);
 	return TRY_RESULT;
@@ -175,6 +1393,27 @@ int PngSetCompressionLevel(ps_png_struct* handle, int level) {
 	return TRY_RESULT;
 }
 
+int PngSetThreads(ps_png_struct* handle, int threads) {
+	TRY {
+		if (handle->png_ptr->mode & PNG_HAVE_IDAT)
+			png_error(handle->png_ptr, "Thread count cannot be changed after image data has been written.");
+
+		freeParallel(handle->mt_ptr);
+		handle->mt_ptr = NULL;
+
+		if (threads > 1) {
+			ps_mt_data* mt = (ps_mt_data*)calloc(1, sizeof(ps_mt_data));
+			if (!mt)
+				png_error(handle->png_ptr, "Out of memory.");
+
+			mt->threads = threads < MT_MAX_THREADS ? threads : MT_MAX_THREADS;
+			mt->enabled = -1;
+			handle->mt_ptr = mt;
+		}
+	}
+	return TRY_RESULT;
+}
+
 int PngWriteSig(ps_png_struct* handle) {
 	TRY png_write_sig(handle->png_ptr);
 	return TRY_RESULT;
@@ -224,32 +1463,74 @@ int PngWriteActl(ps_png_struct* handle, png_uint_32 num_frames, png_uint_32 num_
 }
 
 int PngWriteFrameHead(ps_png_struct* handle, png_uint_32 width, png_uint_32 height, png_uint_32 x_offset, png_uint_32 y_offset, png_uint_16 delay_num, png_uint_16 delay_den, png_byte dispose_op, png_byte blend_op) {
+	uint64_t start = ticks();
 	TRY png_write_frame_head(handle->png_ptr, NULL, NULL, width, height, x_offset, y_offset, delay_num, delay_den, dispose_op, blend_op);
+	endStage(handle, PS_PNG_STAGE_HEADER, start, 0);
 	return TRY_RESULT;
 }
 
 int PngWriteFrameTail(ps_png_struct* handle) {
+	uint64_t start = ticks();
 	TRY png_write_frame_tail(handle->png_ptr, NULL);
+	endStage(handle, PS_PNG_STAGE_FINISH, start, 0);
 	return TRY_RESULT;
 }
 
 int PngWriteRow(ps_png_struct* handle, png_const_bytep row) {
-	TRY png_write_row(handle->png_ptr, row);
+	uint64_t start = ticks();
+	TRY {
+		if (handle->mt_ptr && startParallel(handle))
+			stageRow(handle, row, TRUE);
+		else
+			png_write_row(handle->png_ptr, row);
+	}
+	endStage(handle, PS_PNG_STAGE_ROWS, start, !_jmp_res);
 	return TRY_RESULT;
 }
 
 int PngWriteImage(ps_png_struct* handle, png_bytepp image) {
-	TRY png_write_image(handle->png_ptr, image);
+	uint64_t start = ticks();
+	TRY {
+		if (handle->mt_ptr && startParallel(handle)) {
+			ps_mt_data* mt = handle->mt_ptr;
+			for (png_uint_32 y = mt->rows_done + mt->staged; y < mt->height; y++)
+				stageRow(handle, image[y], FALSE);
+		} else {
+			png_write_image(handle->png_ptr, image);
+		}
+	}
+	endStage(handle, PS_PNG_STAGE_ROWS, start, _jmp_res ? 0 : handle->png_ptr->height);
 	return TRY_RESULT;
 }
 
 int PngWriteIend(ps_png_struct* handle) {
-	TRY png_write_IEND(handle->png_ptr);
+	uint64_t start = ticks();
+	TRY {
+		png_write_IEND(handle->png_ptr);
+		if (!handle->io_ptr->mem_dest)
+			flushData(handle->png_ptr, handle->io_ptr);
+	}
+	endStage(handle, PS_PNG_STAGE_FINISH, start, 0);
 	return TRY_RESULT;
 }
 
 int PngReadInfo(ps_png_struct* handle) {
-	TRY png_read_info(handle->png_ptr, handle->info_ptr);
+	uint64_t start = ticks();
+	TRY {
+		png_read_info(handle->png_ptr, handle->info_ptr);
+
+		// png_read_info stops after the first IDAT chunk header, which is where a row index pre-pass starts.
+		ps_png_index* idx = handle->index_ptr;
+		if (!idx)
+			idx = handle->index_ptr = (ps_png_index*)calloc(1, sizeof(ps_png_index));
+		if (!idx)
+			png_error(handle->png_ptr, "Out of memory.");
+
+		idx->idat_pos = tellData(handle->io_ptr);
+		idx->idat_len = handle->png_ptr->idat_size;
+		idx->len = 0;
+	}
+	endStage(handle, PS_PNG_STAGE_HEADER, start, 0);
 	return TRY_RESULT;
 }
 
@@ -274,31 +1555,91 @@ int PngSetInterlaceHandling(ps_png_struct* handle) {
 }
 
 int PngReadUpdateInfo(ps_png_struct* handle) {
+	uint64_t start = ticks();
 	TRY png_read_update_info(handle->png_ptr, handle->info_ptr);
+	endStage(handle, PS_PNG_STAGE_HEADER, start, 0);
 	return TRY_RESULT;
 }
 
 int PngReadFrameHead(ps_png_struct* handle) {
+	uint64_t start = ticks();
 	TRY {
 		png_read_finish_IDAT(handle->png_ptr);
 		png_read_frame_head(handle->png_ptr, handle->info_ptr);
 		png_read_start_row(handle->png_ptr);
 	}
+	endStage(handle, PS_PNG_STAGE_HEADER, start, 0);
 	return TRY_RESULT;
 }
 
 int PngReadRow(ps_png_struct* handle, png_bytep row) {
+	uint64_t start = ticks();
 	TRY png_read_row(handle->png_ptr, row, NULL);
+	endStage(handle, PS_PNG_STAGE_ROWS, start, !_jmp_res);
 	return TRY_RESULT;
 }
 
 int PngReadImage(ps_png_struct* handle, png_bytepp image) {
+	uint64_t start = ticks();
 	TRY png_read_image(handle->png_ptr, image);
+	endStage(handle, PS_PNG_STAGE_ROWS, start, _jmp_res ? 0 : handle->png_ptr->height);
 	return TRY_RESULT;
 }
 
+int PngReadPasses(ps_png_struct* handle, int passes, png_bytepp image) {
+	uint64_t start = ticks();
+	png_uint_32 width, height = 0;
+
+	TRY {
+		readPasses(handle, passes, image);
+		PngGetPassSize(handle, passes, &width, &height);
+	}
+	endStage(handle, PS_PNG_STAGE_ROWS, start, height);
+	return TRY_RESULT;
+}
+
+void PngGetPassSize(ps_png_struct* handle, int passes, png_uint_32* width, png_uint_32* height) {
+	png_structp png_ptr = handle->png_ptr;
+	int xshift = PASS_X_SHIFT(passes);
+	int yshift = PASS_Y_SHIFT(passes);
+
+	*width = (png_uint_32)(((size_t)png_ptr->width + ((size_t)1 << xshift) - 1) >> xshift);
+	*height = (png_uint_32)(((size_t)png_ptr->height + ((size_t)1 << yshift) - 1) >> yshift);
+}
+
 int PngReadEnd(ps_png_struct* handle, png_infop end_info) {
+	uint64_t start = ticks();
 	TRY png_read_end(handle->png_ptr, end_info);
+	endStage(handle, PS_PNG_STAGE_FINISH, start, 0);
+	return TRY_RESULT;
+}
+
+int PngBuildIndex(ps_png_struct* handle, size_t spacing) {
+	uint64_t start = ticks();
+	TRY buildIndex(handle, spacing ? spacing : IDX_DEFAULT_SPACING);
+	CATCH abortIndex(handle->index_ptr);
+	endStage(handle, PS_PNG_STAGE_INDEX, start, 0);
+	return TRY_RESULT;
+}
+
+void PngGetIndex(ps_png_struct* handle, png_const_bytep* data, size_t* len) {
+	ps_png_index* idx = handle->index_ptr;
+	*data = idx && idx->len ? idx->data : NULL;
+	*len = idx ? idx->len : 0;
+}
+
+int PngSetIndex(ps_png_struct* handle, png_const_bytep data, size_t len) {
+	uint64_t start = ticks();
+	TRY setIndex(handle, data, len);
+	endStage(handle, PS_PNG_STAGE_INDEX, start, 0);
+	return TRY_RESULT;
+}
+
+int PngSeekRow(ps_png_struct* handle, png_uint_32 row) {
+	uint64_t start = ticks();
+	TRY seekRow(handle, row);
+	CATCH abortIndex(handle->index_ptr);
+	endStage(handle, PS_PNG_STAGE_INDEX, start, 0);
 	return TRY_RESULT;
 }
 
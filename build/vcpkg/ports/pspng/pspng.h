@@ -9,16 +9,61 @@
 #define TRUE 1
 #define FALSE 0
 
+// PngGetStats stages.  Each exported call is charged to one of these, including any time it spends in callbacks.
+#define PS_PNG_STAGE_HEADER 0 // info and frame header reads and writes
+#define PS_PNG_STAGE_ROWS 1   // row, image and pass reads and writes, which include inflate/deflate and filtering
+#define PS_PNG_STAGE_INDEX 2  // row index builds and seeks
+#define PS_PNG_STAGE_FINISH 3 // end of frame and image reads and writes
+#define PS_PNG_STAGE_COUNT 4
+
+// Per-handle counters, accumulated until PngResetStats.  Times are in nanoseconds.  Memory sources and destinations
+// count the bytes actually consumed or produced, with no callbacks.
+typedef struct {
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	uint64_t read_calls;
+	uint64_t write_calls;
+	uint64_t seek_calls;
+	uint64_t callback_ns;
+	uint64_t rows;
+	uint64_t stage_ns[PS_PNG_STAGE_COUNT];
+} ps_png_stats;
+
 typedef struct {
 	intptr_t stream_handle;
 	size_t(*write_callback)(intptr_t, png_bytep, size_t);
 	size_t(*read_callback)(intptr_t, png_bytep, size_t);
+	size_t(*seek_callback)(intptr_t, size_t);
+	png_bytep buff;
+	size_t buff_size;
+	size_t buff_len;
+	size_t buff_pos;
+	size_t read_pos;
+	png_const_bytep mem;
+	size_t mem_len;
+	size_t mem_pos;
+	int mem_dest;
+	ps_png_stats stats;
 } ps_io_data;
 
+#ifndef PS_ALLOCATOR_DEFINED
+#define PS_ALLOCATOR_DEFINED
+typedef struct {
+	void* state;
+	void*(*alloc)(void* state, size_t size);
+	void(*free)(void* state, void* mem);
+} ps_allocator;
+#endif
+
+typedef struct ps_mt_data ps_mt_data;
+typedef struct ps_png_index ps_png_index;
+
 typedef struct {
 	png_structp png_ptr;
 	png_infop info_ptr;
 	ps_io_data* io_ptr;
+	ps_mt_data* mt_ptr;
+	ps_png_index* index_ptr;
 } ps_png_struct;
 
 #if defined(__GNUC__) && defined(DLLDEFINE)
@@ -39,14 +84,24 @@ DLLEXPORT png_uint_32 PngVersion();
 
 DLLEXPORT ps_png_struct* PngCreateWrite();
 DLLEXPORT ps_png_struct* PngCreateRead();
+DLLEXPORT ps_png_struct* PngCreateWriteWithAllocator(const ps_allocator* allocator, size_t retain);
+DLLEXPORT ps_png_struct* PngCreateReadWithAllocator(const ps_allocator* allocator, size_t retain);
 DLLEXPORT int PngResetRead(ps_png_struct* handle);
 
 DLLEXPORT void PngDestroyWrite(ps_png_struct* handle);
 DLLEXPORT void PngDestroyRead(ps_png_struct* handle);
 DLLEXPORT const char* PngGetLastError(ps_png_struct* handle);
+DLLEXPORT void PngGetStats(ps_png_struct* handle, ps_png_stats* stats);
+DLLEXPORT void PngResetStats(ps_png_struct* handle);
+
+DLLEXPORT int PngSetBufferSize(ps_png_struct* handle, size_t size);
+DLLEXPORT int PngSetMemorySource(ps_png_struct* handle, png_const_bytep buff, size_t len);
+DLLEXPORT int PngSetMemoryDest(ps_png_struct* handle);
+DLLEXPORT void PngGetMemoryDest(ps_png_struct* handle, png_const_bytep* buff, size_t* len);
 
 DLLEXPORT int PngSetFilter(ps_png_struct* handle, int filters);
 DLLEXPORT int PngSetCompressionLevel(ps_png_struct* handle, int level);
+DLLEXPORT int PngSetThreads(ps_png_struct* handle, int threads);
 
 DLLEXPORT int PngWriteSig(ps_png_struct* handle);
 DLLEXPORT int PngWriteIhdr(ps_png_struct* handle, png_uint_32 width, png_uint_32 height, int bit_depth, int color_type, int interlace_method);
@@ -72,8 +127,15 @@ DLLEXPORT int PngReadUpdateInfo(ps_png_struct* handle);
 DLLEXPORT int PngReadFrameHead(ps_png_struct* handle);
 DLLEXPORT int PngReadRow(ps_png_struct* handle, png_bytep row);
 DLLEXPORT int PngReadImage(ps_png_struct* handle, png_bytepp image);
+DLLEXPORT int PngReadPasses(ps_png_struct* handle, int passes, png_bytepp image);
+DLLEXPORT void PngGetPassSize(ps_png_struct* handle, int passes, png_uint_32* width, png_uint_32* height);
 DLLEXPORT int PngReadEnd(ps_png_struct* handle, png_infop end_info);
 
+DLLEXPORT int PngBuildIndex(ps_png_struct* handle, size_t spacing);
+DLLEXPORT void PngGetIndex(ps_png_struct* handle, png_const_bytep* data, size_t* len);
+DLLEXPORT int PngSetIndex(ps_png_struct* handle, png_const_bytep data, size_t len);
+DLLEXPORT int PngSeekRow(ps_png_struct* handle, png_uint_32 row);
+
 DLLEXPORT int PngGetValid(ps_png_struct* handle, png_uint_32 flag);
 DLLEXPORT int PngGetIhdr(ps_png_struct* handle, png_uint_32* width, png_uint_32* height, int* bit_depth, int* color_type, int* interlace_method);
 DLLEXPORT void PngGetIccp(ps_png_struct* handle, png_bytepp profile, png_uint_32* proflen);
@@ -0,0 +1,359 @@
+// Copyright © Clinton Ingram and Contributors.  Licensed under the MIT License.
+
+// Benchmarks for pspng, in two sections:
+//
+// corpus: Encodes and decodes a fixed corpus of synthetic images covering several sizes, color types, bit depths
+// and interlace modes through stream callbacks, as the managed wrapper does, and reports the best time for each
+// along with the PngGetStats breakdown of that run.  Encodes are timed single-threaded and with the requested
+// thread count (parallel filtering and deflate; interlaced images fall back to single-threaded).  Interlaced
+// images also time a 1/8 scale PngReadPasses decode.
+//
+// levels: Compresses one synthetic image at every zlib level, single-threaded and with the requested thread
+// count, and reports throughput and output size so the cost of parallel block splitting can be weighed.
+//
+// With no arguments, both sections run with their defaults.
+//
+// usage: pspngbench corpus [threads] [iterations] [level]
+//        pspngbench levels [width] [height] [channels] [threads] [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pspng.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+typedef struct {
+	png_uint_32 width;
+	png_uint_32 height;
+} bench_size;
+
+typedef struct {
+	const char* name;
+	int color_type;
+	int channels;
+} bench_color;
+
+typedef struct {
+	png_bytep data;
+	size_t size;
+	size_t len;
+	size_t pos;
+} bench_stream;
+
+static const bench_size sizes[] = { { 640, 480 }, { 1920, 1080 }, { 4096, 3072 } };
+static const bench_color colors[] = { { "gray", PNG_COLOR_TYPE_GRAY, 1 }, { "rgb", PNG_COLOR_TYPE_RGB, 3 }, { "rgba", PNG_COLOR_TYPE_RGB_ALPHA, 4 } };
+static const int depths[] = { 8, 16 };
+static const bench_color channel_colors[] = { { "gray", PNG_COLOR_TYPE_GRAY, 1 }, { "graya", PNG_COLOR_TYPE_GRAY_ALPHA, 2 }, { "rgb", PNG_COLOR_TYPE_RGB, 3 }, { "rgba", PNG_COLOR_TYPE_RGB_ALPHA, 4 } };
+
+static double now() {
+#ifdef _WIN32
+	LARGE_INTEGER freq, count;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+static double ms(uint64_t ns) {
+	return (double)ns * 1e-6;
+}
+
+// Smooth gradients with low-amplitude noise: compresses roughly like a photo,
+// so neither the filter nor the deflate stage dominates unrealistically.
+// 16-bit samples are written big-endian, with the noise in the low byte.
+static png_bytep makeImage(png_uint_32 width, png_uint_32 height, int channels, int depth) {
+	int bps = depth / 8;
+	size_t stride = (size_t)width * channels * bps;
+	png_bytep pixels = (png_bytep)malloc(stride * height);
+	if (!pixels)
+		return NULL;
+
+	uint32_t seed = 0x2545f491;
+	for (png_uint_32 y = 0; y < height; y++) {
+		png_bytep row = pixels + stride * y;
+		for (png_uint_32 x = 0; x < width; x++) {
+			for (int c = 0; c < channels; c++) {
+				seed ^= seed << 13;
+				seed ^= seed >> 17;
+				seed ^= seed << 5;
+
+				int v = (int)((x * (c + 1) + y * (channels - c)) * 255 / (width + height)) + (int)(seed & 7) - 4;
+				png_bytep sample = row + ((size_t)x * channels + c) * bps;
+				sample[0] = (png_byte)(v < 0 ? 0 : v > 255 ? 255 : v);
+				if (bps == 2)
+					sample[1] = (png_byte)(seed >> 8);
+			}
+		}
+	}
+
+	return pixels;
+}
+
+static size_t writeStream(intptr_t pinst, png_bytep buff, size_t cb) {
+	bench_stream* stream = (bench_stream*)pinst;
+
+	if (stream->len + cb > stream->size) {
+		size_t size = (stream->len + cb) * 2;
+		png_bytep data = (png_bytep)realloc(stream->data, size);
+		if (!data)
+			return 0;
+
+		stream->data = data;
+		stream->size = size;
+	}
+
+	memcpy(stream->data + stream->len, buff, cb);
+	stream->len += cb;
+
+	return cb;
+}
+
+static size_t readStream(intptr_t pinst, png_bytep buff, size_t cb) {
+	bench_stream* stream = (bench_stream*)pinst;
+
+	if (cb > stream->len - stream->pos)
+		cb = stream->len - stream->pos;
+
+	memcpy(buff, stream->data + stream->pos, cb);
+	stream->pos += cb;
+
+	return cb;
+}
+
+static size_t seekStream(intptr_t pinst, size_t pos) {
+	bench_stream* stream = (bench_stream*)pinst;
+
+	stream->pos = pos < stream->len ? pos : stream->len;
+
+	return stream->pos;
+}
+
+static int encode(png_bytepp rows, const bench_size* size, const bench_color* color, int depth, int interlace, int level, int threads, bench_stream* out, ps_png_stats* stats) {
+	ps_png_struct* handle = PngCreateWrite();
+	if (!handle)
+		return FALSE;
+
+	handle->io_ptr->stream_handle = (intptr_t)out;
+	handle->io_ptr->write_callback = writeStream;
+	out->len = 0;
+
+	int ok = PngSetCompressionLevel(handle, level) &&
+		PngSetThreads(handle, threads) &&
+		PngWriteSig(handle) &&
+		PngWriteIhdr(handle, size->width, size->height, depth, color->color_type, interlace) &&
+		PngWriteImage(handle, rows) &&
+		PngWriteIend(handle);
+
+	if (!ok)
+		fprintf(stderr, "encode failed: %s\n", PngGetLastError(handle));
+
+	PngGetStats(handle, stats);
+	PngDestroyWrite(handle);
+	return ok;
+}
+
+// Decodes the full image, or only the first `passes` Adam7 passes of an interlaced one.
+static int decode(png_bytepp rows, bench_stream* in, int passes, ps_png_stats* stats) {
+	ps_png_struct* handle = PngCreateRead();
+	if (!handle)
+		return FALSE;
+
+	handle->io_ptr->stream_handle = (intptr_t)in;
+	handle->io_ptr->read_callback = readStream;
+	handle->io_ptr->seek_callback = seekStream;
+	in->pos = 0;
+
+	png_uint_32 width, height;
+	int depth, color_type, interlace;
+	int ok = PngReadInfo(handle) && PngGetIhdr(handle, &width, &height, &depth, &color_type, &interlace);
+	if (ok && passes == PNG_INTERLACE_ADAM7_PASSES && interlace)
+		ok = PngSetInterlaceHandling(handle);
+
+	ok = ok && PngReadUpdateInfo(handle);
+	if (passes < PNG_INTERLACE_ADAM7_PASSES)
+		ok = ok && PngReadPasses(handle, passes, rows);
+	else
+		ok = ok && PngReadImage(handle, rows);
+
+	ok = ok && PngReadEnd(handle, NULL);
+	if (!ok)
+		fprintf(stderr, "decode failed: %s\n", PngGetLastError(handle));
+
+	PngGetStats(handle, stats);
+	PngDestroyRead(handle);
+	return ok;
+}
+
+// Keeps the stats from the fastest run, so the breakdown matches the reported time.
+static void keepBest(int i, double start, double* secs, ps_png_stats* best, const ps_png_stats* stats) {
+	double elapsed = now() - start;
+	if (i == 0 || elapsed < *secs) {
+		*secs = elapsed;
+		*best = *stats;
+	}
+}
+
+static int benchEncode(png_bytepp rows, const bench_size* size, const bench_color* color, int depth, int interlace, int level, int threads, int iterations, bench_stream* out, double* secs, ps_png_stats* best) {
+	for (int i = 0; i < iterations; i++) {
+		ps_png_stats stats;
+		double start = now();
+		if (!encode(rows, size, color, depth, interlace, level, threads, out, &stats))
+			return FALSE;
+
+		keepBest(i, start, secs, best, &stats);
+	}
+
+	return TRUE;
+}
+
+static int benchDecode(png_bytepp rows, bench_stream* in, int passes, int iterations, double* secs, ps_png_stats* best) {
+	for (int i = 0; i < iterations; i++) {
+		ps_png_stats stats;
+		double start = now();
+		if (!decode(rows, in, passes, &stats))
+			return FALSE;
+
+		keepBest(i, start, secs, best, &stats);
+	}
+
+	return TRUE;
+}
+
+static int benchImage(const bench_size* size, const bench_color* color, int depth, int threads, int iterations, int level, bench_stream* stream) {
+	size_t stride = (size_t)size->width * color->channels * (depth / 8);
+	png_bytep pixels = makeImage(size->width, size->height, color->channels, depth);
+	png_bytep output = (png_bytep)malloc(stride * size->height);
+	png_bytepp rows = (png_bytepp)malloc(size->height * sizeof(png_bytep));
+	png_bytepp out_rows = (png_bytepp)malloc(size->height * sizeof(png_bytep));
+	int ok = pixels && output && rows && out_rows;
+
+	for (png_uint_32 y = 0; ok && y < size->height; y++) {
+		rows[y] = pixels + stride * y;
+		out_rows[y] = output + stride * y;
+	}
+
+	double mb = (double)stride * size->height / (1024 * 1024);
+	for (int interlace = PNG_INTERLACE_NONE; ok && interlace <= PNG_INTERLACE_ADAM7; interlace++) {
+		double st, mt, dt, tt = 0;
+		ps_png_stats es, ps, ds, ts;
+		ok = benchEncode(rows, size, color, depth, interlace, level, 1, iterations, stream, &st, &es) &&
+			benchEncode(rows, size, color, depth, interlace, level, threads, iterations, stream, &mt, &ps) &&
+			benchDecode(out_rows, stream, PNG_INTERLACE_ADAM7_PASSES, iterations, &dt, &ds);
+
+		if (ok && interlace)
+			ok = benchDecode(out_rows, stream, 1, iterations, &tt, &ts);
+
+		if (ok)
+			printf("%5ux%-5u %-4s %2d %-5s %10zu %9.1f %9.1f %9.1f %8.2f %8.2f %8.2f %7llu %7.2f %7llu %7.2f %8.2f\n",
+				size->width, size->height, color->name, depth, interlace ? "adam7" : "none", stream->len, mb / st, mb / mt, mb / dt,
+				ms(ds.stage_ns[PS_PNG_STAGE_HEADER]), ms(ds.stage_ns[PS_PNG_STAGE_ROWS]), ms(ds.stage_ns[PS_PNG_STAGE_FINISH]),
+				(unsigned long long)ds.read_calls, ms(ds.callback_ns), (unsigned long long)es.write_calls, ms(es.callback_ns), tt * 1000);
+	}
+
+	free(out_rows);
+	free(rows);
+	free(output);
+	free(pixels);
+	return ok;
+}
+
+static int runCorpus(int argc, char** argv) {
+	int threads = argc > 0 ? atoi(argv[0]) : 4;
+	int iterations = argc > 1 ? atoi(argv[1]) : 3;
+	int level = argc > 2 ? atoi(argv[2]) : 6;
+
+	if (threads < 1 || iterations < 1 || level < 0 || level > 9)
+		return -1;
+
+	printf("pspng %u, level %d, %d thread(s), best of %d\n", PngVersion(), level, threads, iterations);
+	printf("decode stage and callback times in ms are from the fastest single-threaded run; 1/8 is the pass 1 decode time\n\n");
+	printf("size        color bd scan       bytes enc MB/s  %2dT MB/s dec MB/s   header     rows   finish   reads read ms  writes wrt ms   1/8 ms\n", threads);
+
+	bench_stream stream = { NULL, 0, 0, 0 };
+	int ok = TRUE;
+	for (size_t i = 0; ok && i < sizeof(sizes) / sizeof(sizes[0]); i++)
+		for (size_t c = 0; ok && c < sizeof(colors) / sizeof(colors[0]); c++)
+			for (size_t d = 0; ok && d < sizeof(depths) / sizeof(depths[0]); d++)
+				ok = benchImage(&sizes[i], &colors[c], depths[d], threads, iterations, level, &stream);
+
+	free(stream.data);
+	return ok;
+}
+
+static int runLevels(int argc, char** argv) {
+	png_uint_32 width = argc > 0 ? (png_uint_32)atoi(argv[0]) : 4096;
+	png_uint_32 height = argc > 1 ? (png_uint_32)atoi(argv[1]) : 3072;
+	int channels = argc > 2 ? atoi(argv[2]) : 3;
+	int threads = argc > 3 ? atoi(argv[3]) : 4;
+	int iterations = argc > 4 ? atoi(argv[4]) : 3;
+
+	if (!width || !height || channels < 1 || channels > 4 || threads < 1 || iterations < 1)
+		return -1;
+
+	const bench_size size = { width, height };
+	const bench_color* color = &channel_colors[channels - 1];
+	size_t stride = (size_t)width * channels;
+	png_bytep pixels = makeImage(width, height, channels, 8);
+	png_bytepp rows = (png_bytepp)malloc(height * sizeof(png_bytep));
+	bench_stream stream = { NULL, 0, 0, 0 };
+	int ok = pixels && rows;
+
+	for (png_uint_32 y = 0; ok && y < height; y++)
+		rows[y] = pixels + stride * y;
+
+	double mb = (double)stride * height / (1024 * 1024);
+	printf("pspng %u, %ux%u, %d channel(s), %d thread(s), best of %d\n\n", PngVersion(), width, height, channels, threads, iterations);
+	printf("level   1T MB/s   %2dT MB/s   speedup      1T bytes     %2dT bytes   size delta\n", threads, threads);
+
+	for (int level = 0; ok && level <= 9; level++) {
+		double st, mt;
+		size_t ss, ps;
+		ps_png_stats stats;
+		ok = benchEncode(rows, &size, color, 8, PNG_INTERLACE_NONE, level, 1, iterations, &stream, &st, &stats);
+		ss = stream.len;
+		ok = ok && benchEncode(rows, &size, color, 8, PNG_INTERLACE_NONE, level, threads, iterations, &stream, &mt, &stats);
+		ps = stream.len;
+
+		if (ok)
+			printf("%5d %9.1f %11.1f %8.2fx %13zu %13zu %+11.2f%%\n",
+				level, mb / st, mb / mt, st / mt, ss, ps, ((double)ps - (double)ss) * 100 / (double)ss);
+	}
+
+	free(stream.data);
+	free(rows);
+	free(pixels);
+	return ok;
+}
+
+int main(int argc, char** argv) {
+	int res;
+	if (argc < 2) {
+		res = runCorpus(0, NULL);
+		printf("\n");
+		res = res > 0 && runLevels(0, NULL);
+	}
+	else if (!strcmp(argv[1], "corpus"))
+		res = runCorpus(argc - 2, argv + 2);
+	else if (!strcmp(argv[1], "levels"))
+		res = runLevels(argc - 2, argv + 2);
+	else
+		res = -1;
+
+	if (res < 0) {
+		fprintf(stderr, "usage: %s corpus [threads] [iterations] [level]\n", argv[0]);
+		fprintf(stderr, "       %s levels [width] [height] [channels] [threads] [iterations]\n", argv[0]);
+		return 1;
+	}
+
+	return res ? 0 : 1;
+}
@@ -0,0 +1,687 @@
+// Copyright © Clinton Ingram and Contributors.  Licensed under the MIT License.
+
+// Regression tests for the pspng extensions.  Each test encodes synthetic images with pspng and checks the results
+// of the extended read and write paths against a plain sequential decode of the same data, or against the source.
+//
+// This is built from the pspng sources rather than linked to the library, with a small IDX_IN_SIZE so the row
+// index pre-pass refills its input buffer often and hits inflate block boundaries at every buffer position.
+//
+// usage: pspngtest
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pspng.h"
+#include "zlib.h"
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("FAIL %s:%d: ", __func__, __LINE__); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		fails++; \
+	} \
+} while (0)
+
+typedef struct {
+	png_uint_32 width;
+	png_uint_32 height;
+	int depth;
+	int color_type;
+	int interlace;
+	int level;
+	int threads;
+	int frames;
+} test_image;
+
+typedef struct {
+	png_bytep data;
+	size_t len;
+} test_buffer;
+
+static int channelCount(int color_type) {
+	switch (color_type) {
+		case PNG_COLOR_TYPE_GRAY_ALPHA: return 2;
+		case PNG_COLOR_TYPE_RGB: return 3;
+		case PNG_COLOR_TYPE_RGB_ALPHA: return 4;
+		default: return 1;
+	}
+}
+
+static size_t rowBytes(const test_image* img) {
+	return ((size_t)img->width * channelCount(img->color_type) * img->depth + 7) / 8;
+}
+
+// Gradients with noise in the low bits, so deflate emits many dynamic blocks whose boundaries fall mid-byte.
+static png_bytep makePixels(const test_image* img) {
+	size_t stride = rowBytes(img);
+	png_bytep pixels = (png_bytep)malloc(stride * img->height);
+	if (!pixels)
+		return NULL;
+
+	uint32_t seed = 0x2545f491 ^ img->width ^ (img->height << 16);
+	for (png_uint_32 y = 0; y < img->height; y++) {
+		png_bytep row = pixels + stride * y;
+		for (size_t x = 0; x < stride; x++) {
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+
+			row[x] = (png_byte)((x * 3 + y * 5) / 4 + (seed & 15));
+		}
+	}
+
+	// Palette indices must stay within the palette written by encode.
+	if (img->color_type == PNG_COLOR_TYPE_PALETTE && img->depth == 8) {
+		for (size_t i = 0; i < stride * img->height; i++)
+			pixels[i] &= 0x7F;
+	}
+
+	return pixels;
+}
+
+// Size of the filtered image data, which is what the IDAT or fdAT zlib stream for one frame inflates to.
+static size_t imageDataSize(const test_image* img) {
+	if (!img->interlace)
+		return (rowBytes(img) + 1) * img->height;
+
+	size_t size = 0;
+	for (int pass = 0; pass < 7; pass++) {
+		test_image sub = *img;
+		sub.width = PNG_PASS_COLS(img->width, pass);
+		sub.height = PNG_PASS_ROWS(img->height, pass);
+		if (sub.width && sub.height)
+			size += (rowBytes(&sub) + 1) * sub.height;
+	}
+
+	return size;
+}
+
+// Odd frames of an animation have their rows in reverse order, so each frame has different data.
+static void frameRows(const test_image* img, png_const_bytep pixels, int frame, png_bytepp rows) {
+	size_t stride = rowBytes(img);
+
+	for (png_uint_32 y = 0; y < img->height; y++)
+		rows[y] = (png_bytep)pixels + stride * (frame & 1 ? img->height - 1 - y : y);
+}
+
+static int encode(const test_image* img, png_const_bytep pixels, test_buffer* out) {
+	png_bytepp rows = (png_bytepp)malloc(img->height * sizeof(png_bytep));
+	ps_png_struct* handle = PngCreateWrite();
+	int ok = rows && handle;
+
+	ok = ok && PngSetMemoryDest(handle) &&
+		PngSetCompressionLevel(handle, img->level) &&
+		PngSetThreads(handle, img->threads) &&
+		PngWriteSig(handle) &&
+		PngWriteIhdr(handle, img->width, img->height, img->depth, img->color_type, img->interlace);
+
+	if (ok && img->color_type == PNG_COLOR_TYPE_PALETTE) {
+		png_color palette[256];
+		for (int i = 0; i < 256; i++) {
+			palette[i].red = (png_byte)i;
+			palette[i].green = (png_byte)(255 - i);
+			palette[i].blue = (png_byte)(i * 7);
+		}
+
+		ok = PngWritePlte(handle, palette, 1 << (img->depth < 8 ? img->depth : 7));
+	}
+
+	if (ok && img->frames) {
+		ok = PngWriteActl(handle, img->frames, 0);
+		for (int i = 0; ok && i < img->frames; i++) {
+			frameRows(img, pixels, i, rows);
+			ok = PngWriteFrameHead(handle, img->width, img->height, 0, 0, 1, 10, PNG_DISPOSE_OP_NONE, PNG_BLEND_OP_SOURCE) &&
+				PngWriteImage(handle, rows) &&
+				PngWriteFrameTail(handle);
+		}
+	}
+	else if (ok) {
+		frameRows(img, pixels, 0, rows);
+		ok = PngWriteImage(handle, rows);
+	}
+
+	ok = ok && PngWriteIend(handle);
+	if (ok) {
+		png_const_bytep buff;
+		PngGetMemoryDest(handle, &buff, &out->len);
+		out->data = (png_bytep)malloc(out->len);
+		ok = out->data != NULL;
+		if (ok)
+			memcpy(out->data, buff, out->len);
+	}
+	else if (handle)
+		printf("encode failed: %s\n", PngGetLastError(handle));
+
+	if (handle)
+		PngDestroyWrite(handle);
+
+	free(rows);
+	return ok;
+}
+
+static ps_png_struct* openRead(const test_buffer* png) {
+	ps_png_struct* handle = PngCreateRead();
+	if (!handle)
+		return NULL;
+
+	if (!PngSetMemorySource(handle, png->data, png->len) || !PngReadInfo(handle)) {
+		printf("open failed: %s\n", PngGetLastError(handle));
+		PngDestroyRead(handle);
+		return NULL;
+	}
+
+	return handle;
+}
+
+// Reads the whole image row by row, with libpng deinterlacing if needed.
+static png_bytep decodeSequential(ps_png_struct* handle, const test_image* img) {
+	size_t stride = rowBytes(img);
+	png_bytep pixels = (png_bytep)malloc(stride * img->height);
+	png_bytepp rows = (png_bytepp)malloc(img->height * sizeof(png_bytep));
+	int ok = pixels && rows;
+
+	for (png_uint_32 y = 0; ok && y < img->height; y++)
+		rows[y] = pixels + stride * y;
+
+	if (ok && img->interlace)
+		ok = PngSetInterlaceHandling(handle);
+
+	ok = ok && PngReadUpdateInfo(handle) && PngReadImage(handle, rows) && PngReadEnd(handle, NULL);
+	if (!ok) {
+		printf("decode failed: %s\n", PngGetLastError(handle));
+		free(pixels);
+		pixels = NULL;
+	}
+
+	free(rows);
+	return pixels;
+}
+
+static png_bytep decode(const test_buffer* png, const test_image* img) {
+	ps_png_struct* handle = openRead(png);
+	if (!handle)
+		return NULL;
+
+	png_bytep pixels = decodeSequential(handle, img);
+	PngDestroyRead(handle);
+	return pixels;
+}
+
+// Encodes the test image and decodes it sequentially, checking that the round trip is lossless.
+static int prepare(const test_image* img, png_bytep* pixels, test_buffer* png, png_bytep* expected) {
+	int fails = 0;
+	size_t size = rowBytes(img) * img->height;
+
+	*pixels = makePixels(img);
+	*expected = NULL;
+	png->data = NULL;
+
+	CHECK(*pixels && encode(img, *pixels, png), "encode %ux%u depth %d color %d interlace %d level %d threads %d",
+		img->width, img->height, img->depth, img->color_type, img->interlace, img->level, img->threads);
+
+	if (!fails) {
+		*expected = decode(png, img);
+		CHECK(*expected && !memcmp(*expected, *pixels, size), "sequential decode does not match source");
+	}
+
+	return fails;
+}
+
+static void release(png_bytep pixels, test_buffer* png, png_bytep expected) {
+	free(expected);
+	free(png->data);
+	free(pixels);
+}
+
+// Seeks to the first row of every checkpoint, and the row after it, in reverse order so each seek resets inflate,
+// and checks the rows that follow against the sequential decode.
+static int checkSeeks(ps_png_struct* handle, const test_image* img, png_const_bytep expected) {
+	int fails = 0;
+	size_t stride = rowBytes(img);
+	size_t row_size = stride + 1;
+	size_t entry_size = 32 + (1 << 15) + stride;
+	png_bytep row = (png_bytep)malloc(stride);
+
+	png_const_bytep index;
+	size_t len;
+	PngGetIndex(handle, &index, &len);
+
+	png_uint_32 count = index ? png_get_uint_32(index + 20) : 0;
+	CHECK(row && count > 1 && len == 40 + count * entry_size, "index has %u checkpoints in %zu bytes", count, len);
+
+	for (png_uint_32 i = count; i-- > 0 && !fails;) {
+		png_const_bytep entry = index + 40 + (size_t)i * entry_size;
+		size_t out = (size_t)((uint64_t)png_get_uint_32(entry + 8) << 32 | png_get_uint_32(entry + 12));
+		png_uint_32 first = (png_uint_32)((out + row_size - 1) / row_size);
+
+		for (png_uint_32 target = first; target < first + 2 && target < img->height && !fails; target++) {
+			CHECK(PngSeekRow(handle, target), "seek to row %u (checkpoint %u): %s", target, i, PngGetLastError(handle));
+			for (png_uint_32 y = target; y < target + 3 && y < img->height && !fails; y++) {
+				CHECK(PngReadRow(handle, row), "read row %u: %s", y, PngGetLastError(handle));
+				CHECK(!memcmp(row, expected + stride * y, stride), "row %u after seek to checkpoint %u (bits %u) differs", y, i, entry[20]);
+			}
+		}
+	}
+
+	free(row);
+	return fails;
+}
+
+static int testIndexSeek(const test_image* img) {
+	png_bytep pixels, expected;
+	test_buffer png;
+	int fails = prepare(img, &pixels, &png, &expected);
+
+	if (!fails) {
+		ps_png_struct* handle = openRead(&png);
+		CHECK(handle && PngReadUpdateInfo(handle) && PngBuildIndex(handle, 1), "build index: %s", handle ? PngGetLastError(handle) : "");
+
+		if (!fails)
+			fails += checkSeeks(handle, img, expected);
+
+		if (handle)
+			PngDestroyRead(handle);
+	}
+
+	release(pixels, &png, expected);
+	return fails;
+}
+
+static int appendData(test_buffer* buff, png_const_bytep data, size_t len) {
+	png_bytep grown = (png_bytep)realloc(buff->data, buff->len + len);
+	if (!grown)
+		return FALSE;
+
+	memcpy(grown + buff->len, data, len);
+	buff->data = grown;
+	buff->len += len;
+	return TRUE;
+}
+
+// Inflates one frame's zlib stream outside libpng.  The stream must end exactly at the end of the data, and its
+// Adler-32 trailer must match the inflated bytes.
+static int checkZlibStream(const test_buffer* stream, size_t expected, int frame) {
+	int fails = 0;
+	png_bytep out = (png_bytep)malloc(expected + 1);
+	z_stream zs;
+
+	memset(&zs, 0, sizeof(zs));
+	CHECK(out && stream->len > 6 && inflateInit(&zs) == Z_OK, "frame %d: set up inflate for %zu bytes", frame, stream->len);
+	if (fails) {
+		free(out);
+		return fails;
+	}
+
+	zs.next_in = stream->data;
+	zs.avail_in = (uInt)stream->len;
+	zs.next_out = out;
+	zs.avail_out = (uInt)(expected + 1);
+
+	int ret = inflate(&zs, Z_FINISH);
+	CHECK(ret == Z_STREAM_END, "frame %d: inflate returned %d (%s)", frame, ret, zs.msg ? zs.msg : "no message");
+	CHECK(zs.avail_in == 0, "frame %d: %u bytes after the end of the zlib stream", frame, zs.avail_in);
+	CHECK(zs.total_out == expected, "frame %d: inflated %lu bytes, expected %zu", frame, zs.total_out, expected);
+
+	uLong adler = adler32(adler32(0L, Z_NULL, 0), out, (uInt)zs.total_out);
+	CHECK(adler == png_get_uint_32(stream->data + stream->len - 4), "frame %d: Adler-32 trailer does not match the data", frame);
+
+	inflateEnd(&zs);
+	free(out);
+	return fails;
+}
+
+// Walks the chunks, checking every CRC, and gathers each frame's IDAT or fdAT data for checkZlibStream.
+static int checkStream(const test_image* img, const test_buffer* png) {
+	int fails = 0;
+	int frames = img->frames ? img->frames : 1;
+	int frame = 0, fctl = 0;
+	test_buffer streams[4];
+	size_t pos = 8;
+
+	memset(streams, 0, sizeof(streams));
+	CHECK(frames <= 4, "too many frames for the test");
+
+	while (!fails && pos + 12 <= png->len) {
+		png_uint_32 len = png_get_uint_32(png->data + pos);
+		png_const_bytep type = png->data + pos + 4;
+
+		CHECK(len <= png->len - pos - 12, "chunk at offset %zu runs past the end of the file", pos);
+		if (fails)
+			break;
+
+		CHECK(crc32(crc32(0L, Z_NULL, 0), type, len + 4) == png_get_uint_32(type + 4 + len), "%.4s chunk at offset %zu has a bad CRC", type, pos);
+
+		if (!memcmp(type, "fcTL", 4))
+			frame = fctl++;
+		else if (!memcmp(type, "IDAT", 4))
+			CHECK(appendData(&streams[0], type + 4, len), "gather IDAT data");
+		else if (!memcmp(type, "fdAT", 4))
+			CHECK(len >= 4 && frame < frames && appendData(&streams[frame], type + 8, len - 4), "gather fdAT data for frame %d", frame);
+
+		pos += 12 + (size_t)len;
+	}
+
+	CHECK(fails || pos == png->len, "chunks end at offset %zu of %zu", pos, png->len);
+
+	for (int i = 0; i < frames && !fails; i++)
+		fails += checkZlibStream(&streams[i], imageDataSize(img), i);
+
+	for (int i = 0; i < 4; i++)
+		free(streams[i].data);
+
+	return fails;
+}
+
+// Reads the second frame of an animation and checks it against the reversed source rows it was written from.
+static int checkSecondFrame(const test_image* img, const test_buffer* png, png_const_bytep pixels) {
+	int fails = 0;
+	size_t stride = rowBytes(img);
+	png_bytep frame = (png_bytep)malloc(stride * img->height);
+	png_bytepp rows = (png_bytepp)malloc(img->height * sizeof(png_bytep));
+	ps_png_struct* handle = openRead(png);
+	CHECK(frame && rows && handle, "open animation");
+
+	if (!fails) {
+		for (png_uint_32 y = 0; y < img->height; y++)
+			rows[y] = frame + stride * y;
+
+		CHECK(PngReadUpdateInfo(handle) && PngReadImage(handle, rows) && PngReadFrameHead(handle) && PngReadImage(handle, rows),
+			"read second frame: %s", PngGetLastError(handle));
+	}
+
+	for (png_uint_32 y = 0; y < img->height && !fails; y++)
+		CHECK(!memcmp(frame + stride * y, pixels + stride * (img->height - 1 - y), stride), "second frame row %u differs", y);
+
+	if (handle)
+		PngDestroyRead(handle);
+
+	free(rows);
+	free(frame);
+	return fails;
+}
+
+// Encodes with PngSetThreads and checks that libpng reads back the source pixels, and that the chunks and zlib
+// streams are valid on their own.  Interlaced images and animations are left to libpng, so their output must match a single-threaded
+// encode byte for byte.
+static int testParallelEncode(const test_image* img) {
+	png_bytep pixels, expected;
+	test_buffer png;
+	int fails = prepare(img, &pixels, &png, &expected);
+
+	if (!fails)
+		fails += checkStream(img, &png);
+
+	if (!fails && img->frames > 1)
+		fails += checkSecondFrame(img, &png, pixels);
+
+	if (!fails && (img->interlace || img->frames)) {
+		test_image single = *img;
+		test_buffer serial = { NULL, 0 };
+		single.threads = 1;
+
+		CHECK(encode(&single, pixels, &serial), "single-threaded encode");
+		CHECK(!fails && serial.len == png.len && !memcmp(serial.data, png.data, png.len),
+			"fallback encode with %d threads differs from single-threaded output", img->threads);
+
+		free(serial.data);
+	}
+
+	release(pixels, &png, expected);
+	return fails;
+}
+
+// Decodes every image on one handle, reset between images, and checks each against a decode on a fresh handle.  The
+// images are read twice, and the second time each is abandoned partway through first, so a reset must also clear
+// the state left by an unfinished decode and by a different image format.
+static int testReset(const test_image* imgs, size_t count) {
+	int fails = 0;
+	png_bytep* pixels = (png_bytep*)calloc(count, sizeof(png_bytep));
+	png_bytep* expected = (png_bytep*)calloc(count, sizeof(png_bytep));
+	test_buffer* pngs = (test_buffer*)calloc(count, sizeof(test_buffer));
+	ps_png_struct* handle = PngCreateRead();
+	CHECK(pixels && expected && pngs && handle, "create handle");
+
+	for (size_t i = 0; i < count && !fails; i++)
+		fails += prepare(&imgs[i], &pixels[i], &pngs[i], &expected[i]);
+
+	for (int round = 0; round < 2 && !fails; round++) {
+		for (size_t i = 0; i < count && !fails; i++) {
+			const test_image* img = &imgs[i];
+			size_t size = rowBytes(img) * img->height;
+
+			if (round) {
+				png_bytep row = (png_bytep)malloc(rowBytes(img));
+				CHECK(row && PngSetMemorySource(handle, pngs[i].data, pngs[i].len) && PngReadInfo(handle) &&
+					PngReadUpdateInfo(handle) && PngReadRow(handle, row) && PngReadRow(handle, row),
+					"partial decode of image %zu: %s", i, PngGetLastError(handle));
+				CHECK(PngResetRead(handle), "reset after partial decode of image %zu: %s", i, PngGetLastError(handle));
+				free(row);
+			}
+
+			CHECK(PngSetMemorySource(handle, pngs[i].data, pngs[i].len) && PngReadInfo(handle),
+				"open image %zu on reset handle: %s", i, PngGetLastError(handle));
+
+			png_bytep reused = fails ? NULL : decodeSequential(handle, img);
+			CHECK(reused && !memcmp(reused, expected[i], size), "image %zu round %d on reset handle differs", i, round);
+			CHECK(PngResetRead(handle), "reset after image %zu: %s", i, PngGetLastError(handle));
+			free(reused);
+		}
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		if (pixels && expected && pngs)
+			release(pixels[i], &pngs[i], expected[i]);
+	}
+
+	if (handle)
+		PngDestroyRead(handle);
+
+	free(pngs);
+	free(expected);
+	free(pixels);
+	return fails;
+}
+
+// Decodes with low bit depths and palettes expanded to 8-bit samples, the way the managed decoder sets up every
+// image that has them.
+static png_bytep decodeExpanded(const test_buffer* png, const test_image* img, size_t bpp) {
+	ps_png_struct* handle = openRead(png);
+	size_t stride = (size_t)img->width * bpp;
+	png_bytep pixels = (png_bytep)malloc(stride * img->height);
+	png_bytepp rows = (png_bytepp)malloc(img->height * sizeof(png_bytep));
+	int ok = handle && pixels && rows;
+
+	for (png_uint_32 y = 0; ok && y < img->height; y++)
+		rows[y] = pixels + stride * y;
+
+	ok = ok && PngSetExpand(handle) && PngSetInterlaceHandling(handle) && PngReadUpdateInfo(handle) &&
+		PngReadImage(handle, rows) && PngReadEnd(handle, NULL);
+	if (!ok) {
+		if (handle)
+			printf("decode failed: %s\n", PngGetLastError(handle));
+
+		free(pixels);
+		pixels = NULL;
+	}
+
+	if (handle)
+		PngDestroyRead(handle);
+
+	free(rows);
+	return pixels;
+}
+
+// Reads the leading Adam7 passes as a packed sub-image and checks it against the full decode sampled at the pixels
+// those passes hold: every 8th, 4th or 2nd pixel in each direction after 1, 3 or 5 passes, and every pixel after 7.
+static int testPassDecode(const test_image* img) {
+	static const int passes[] = { 1, 3, 5, 7 };
+	static const png_uint_32 scales[] = { 8, 4, 2, 1 };
+
+	int fails = 0;
+	int expand = img->depth < 8;
+	size_t bpp = !expand ? rowBytes(img) / img->width : img->color_type == PNG_COLOR_TYPE_PALETTE ? 3 : 1;
+	png_bytep pixels = makePixels(img);
+	test_buffer png = { NULL, 0 };
+
+	CHECK(pixels && encode(img, pixels, &png), "encode %ux%u depth %d color %d", img->width, img->height, img->depth, img->color_type);
+	png_bytep expected = fails ? NULL : expand ? decodeExpanded(&png, img, bpp) : decode(&png, img);
+	CHECK(fails || expected, "full decode of %ux%u depth %d color %d", img->width, img->height, img->depth, img->color_type);
+
+	for (size_t p = 0; p < sizeof(passes) / sizeof(passes[0]) && !fails; p++) {
+		ps_png_struct* handle = openRead(&png);
+		CHECK(handle && PngSetInterlaceHandling(handle) && (!expand || PngSetExpand(handle)) && PngReadUpdateInfo(handle),
+			"open for %d passes", passes[p]);
+		if (fails) {
+			if (handle)
+				PngDestroyRead(handle);
+			break;
+		}
+
+		png_uint_32 width, height, scale = scales[p];
+		PngGetPassSize(handle, passes[p], &width, &height);
+		CHECK(width == (img->width + scale - 1) / scale && height == (img->height + scale - 1) / scale,
+			"%ux%u after %d passes is %ux%u", img->width, img->height, passes[p], width, height);
+
+		png_bytep out = fails ? NULL : (png_bytep)calloc((size_t)width * height, bpp);
+		png_bytepp rows = fails ? NULL : (png_bytepp)malloc(height * sizeof(png_bytep));
+		CHECK(out && rows, "allocate %ux%u", width, height);
+
+		for (png_uint_32 y = 0; !fails && y < height; y++)
+			rows[y] = out + (size_t)width * bpp * y;
+
+		CHECK(fails || (PngReadPasses(handle, passes[p], rows) && PngReadEnd(handle, NULL)), "read %d passes of %ux%u depth %d color %d: %s",
+			passes[p], img->width, img->height, img->depth, img->color_type, PngGetLastError(handle));
+
+		for (png_uint_32 y = 0; !fails && y < height; y++) {
+			for (png_uint_32 x = 0; !fails && x < width; x++) {
+				png_const_bytep src = expected + ((size_t)y * scale * img->width + (size_t)x * scale) * bpp;
+				CHECK(!memcmp(rows[y] + x * bpp, src, bpp), "%ux%u depth %d color %d after %d passes differs at %u,%u", img->width,
+					img->height, img->depth, img->color_type, passes[p], x, y);
+			}
+		}
+
+		free(rows);
+		free(out);
+		PngDestroyRead(handle);
+	}
+
+	release(pixels, &png, expected);
+	return fails;
+}
+
+// Pass reads need an interlaced image with whole-byte pixels, read from the start, for a pass count from 1 to 7.
+static int testPassErrors() {
+	static const test_image plain = { 160, 120, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE, 6, 1, 0 };
+	static const test_image packed = { 301, 67, 2, PNG_COLOR_TYPE_PALETTE, PNG_INTERLACE_ADAM7, 6, 1, 0 };
+	static const test_image interlaced = { 233, 177, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_ADAM7, 6, 1, 0 };
+	static const struct {
+		const test_image* img;
+		int passes;
+		int rows_read;
+		const char* error;
+	} cases[] = {
+		{ &plain, 3, 0, "Image is not interlaced." },
+		{ &packed, 3, 0, "Pass reads require at least 8 bits per pixel." },
+		{ &interlaced, 0, 0, "Invalid pass count." },
+		{ &interlaced, 8, 0, "Invalid pass count." },
+		{ &interlaced, 3, 1, "Rows have already been read." }
+	};
+
+	int fails = 0;
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		const test_image* img = cases[i].img;
+		png_bytep pixels = makePixels(img);
+		test_buffer png = { NULL, 0 };
+		ps_png_struct* handle = NULL;
+		png_bytep out = NULL;
+		png_bytepp rows = (png_bytepp)malloc(img->height * sizeof(png_bytep));
+
+		CHECK(pixels && rows && encode(img, pixels, &png), "encode case %zu", i);
+		if (!fails) {
+			handle = openRead(&png);
+			out = (png_bytep)malloc(rowBytes(img) * img->height);
+			CHECK(handle && out && PngSetInterlaceHandling(handle) && PngReadUpdateInfo(handle), "open case %zu", i);
+		}
+
+		for (png_uint_32 y = 0; !fails && y < img->height; y++)
+			rows[y] = out + rowBytes(img) * y;
+
+		if (!fails && cases[i].rows_read)
+			CHECK(PngReadRow(handle, rows[0]), "read row for case %zu: %s", i, PngGetLastError(handle));
+
+		if (!fails) {
+			CHECK(!PngReadPasses(handle, cases[i].passes, rows), "%d passes in case %zu succeeded", cases[i].passes, i);
+			CHECK(!strcmp(PngGetLastError(handle), cases[i].error), "%d passes in case %zu failed with \"%s\"", cases[i].passes, i,
+				PngGetLastError(handle));
+		}
+
+		if (handle)
+			PngDestroyRead(handle);
+
+		free(out);
+		free(rows);
+		free(png.data);
+		free(pixels);
+	}
+
+	return fails;
+}
+
+int main() {
+	static const test_image index_images[] = {
+		{ 301, 199, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE, 6, 1, 0 },
+		{ 301, 199, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE, 1, 1, 0 },
+		{ 517, 131, 16, PNG_COLOR_TYPE_GRAY_ALPHA, PNG_INTERLACE_NONE, 9, 1, 0 },
+		{ 640, 480, 8, PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE, 6, 4, 0 },
+		{ 777, 93, 4, PNG_COLOR_TYPE_PALETTE, PNG_INTERLACE_NONE, 6, 1, 0 }
+	};
+
+	static const test_image reset_images[] = {
+		{ 233, 177, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_ADAM7, 6, 1, 0 },
+		{ 160, 120, 8, PNG_COLOR_TYPE_PALETTE, PNG_INTERLACE_NONE, 6, 1, 0 },
+		{ 97, 203, 16, PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE, 6, 1, 0 },
+		{ 301, 67, 2, PNG_COLOR_TYPE_PALETTE, PNG_INTERLACE_ADAM7, 6, 1, 0 },
+		{ 64, 64, 16, PNG_COLOR_TYPE_GRAY, PNG_INTERLACE_ADAM7, 6, 1, 0 }
+	};
+
+	// Each block is 128K of filtered data, so the larger images need several batches of blocks per thread count.
+	static const test_image parallel_images[] = {
+		{ 640, 480, 8, PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE, 6, 4, 0 },
+		{ 1031, 517, 16, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE, 9, 3, 0 },
+		{ 2000, 300, 8, PNG_COLOR_TYPE_GRAY, PNG_INTERLACE_NONE, 1, 8, 0 },
+		{ 777, 400, 4, PNG_COLOR_TYPE_PALETTE, PNG_INTERLACE_NONE, 6, 4, 0 },
+		{ 300, 300, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE, 0, 2, 0 },
+		{ 1, 40000, 8, PNG_COLOR_TYPE_GRAY_ALPHA, PNG_INTERLACE_NONE, 6, 4, 0 },
+		{ 640, 480, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_ADAM7, 6, 4, 0 },
+		{ 320, 240, 8, PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE, 6, 4, 2 }
+	};
+
+	// Sizes that are not multiples of 8 leave partial pass columns and rows at the right and bottom, and the 5x3 image
+	// has empty passes.  The low bit depths are read expanded, as the managed decoder reads them.
+	static const test_image pass_images[] = {
+		{ 233, 177, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_ADAM7, 6, 1, 0 },
+		{ 97, 61, 16, PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_ADAM7, 6, 1, 0 },
+		{ 5, 3, 8, PNG_COLOR_TYPE_GRAY_ALPHA, PNG_INTERLACE_ADAM7, 6, 1, 0 },
+		{ 301, 67, 2, PNG_COLOR_TYPE_PALETTE, PNG_INTERLACE_ADAM7, 6, 1, 0 },
+		{ 123, 77, 1, PNG_COLOR_TYPE_GRAY, PNG_INTERLACE_ADAM7, 6, 1, 0 }
+	};
+
+	int fails = 0;
+	for (size_t i = 0; i < sizeof(index_images) / sizeof(index_images[0]); i++)
+		fails += testIndexSeek(&index_images[i]);
+
+	for (size_t i = 0; i < sizeof(parallel_images) / sizeof(parallel_images[0]); i++)
+		fails += testParallelEncode(&parallel_images[i]);
+
+	fails += testReset(reset_images, sizeof(reset_images) / sizeof(reset_images[0]));
+
+	for (size_t i = 0; i < sizeof(pass_images) / sizeof(pass_images[0]); i++)
+		fails += testPassDecode(&pass_images[i]);
+
+	fails += testPassErrors();
+
+	printf("pspng %u: %s (%d failures)\n", PngVersion(), fails ? "FAILED" : "passed", fails);
+	return fails ? 1 : 0;
+}
@@ -175,6 +175,9 @@ internal interface IScaledDecoder : IImageFrame
 	(int width, int height) SetDecodeScale(int ratio);
 }
 
+// Marks a scaled decoder whose reduced output is point-sampled rather than filtered, so it is only used when speed is preferred.
+internal interface IPointSampledScaledDecoder : IScaledDecoder { }
+
 internal interface IAnimatedImageEncoder : IImageEncoder
 {
 	void WriteAnimationMetadata(IMetadataSource metadata);
@@ -385,6 +385,15 @@ internal static class MagicTransforms
 		if (ratio == 1)
 			return;
 
+		// A point-sampled decode aliases where the hybrid scaler would have box-filtered, so in the default FavorQuality
+		// mode it is only used when the interpolator is point-sampled anyway.  Speed modes may use it in place of the
+		// hybrid scaler, but only for the 8-bit formats that scaler supports.
+		if (sdec is IPointSampledScaledDecoder && !ctx.Settings.Interpolation.IsPointSampler)
+		{
+			if (ctx.Settings.HybridMode == HybridScaleMode.FavorQuality || ctx.Source.Format.BitsPerPixel / ctx.Source.Format.ChannelCount != 8)
+				return;
+		}
+
 		var (ow, oh) = (sdec.PixelSource.Width, sdec.PixelSource.Height);
 		var (cw, ch) = sdec.SetDecodeScale(ratio);
 
@@ -102,6 +102,27 @@ internal unsafe struct StreamWrapper
 		return len > stm.Length - offset;
 	}
 
+	public readonly bool TryGetMemory(out byte* pb, out nuint cb)
+	{
+		if (Unsafe.As<Stream>(source.Target!) is UnmanagedMemoryStream { CanRead: true } ums)
+		{
+			try
+			{
+				pb = ums.PositionPointer;
+				cb = (nuint)(ums.Length - ums.Position);
+				return true;
+			}
+			catch (NotSupportedException)
+			{
+				// UnmanagedMemoryStream wrapping a SafeBuffer doesn't expose a pointer.
+			}
+		}
+
+		pb = null;
+		cb = 0;
+		return false;
+	}
+
 	public void SetException(ExceptionDispatchInfo edi) => exception = GCHandle.Alloc(edi);
 
 	public readonly void ThrowIfExceptional()
@@ -0,0 +1,22 @@
+// Copyright © Clinton Ingram and Contributors
+// SPDX-License-Identifier: MIT
+
+// Ported from libjpeg-turbo headers (transupp.h)
+// This software is based in part on the work of the Independent JPEG Group.
+// See third-party-notices in the repository root for more information.
+
+namespace PhotoSauce.Interop.Libjpeg;
+
+internal enum JXFORM_CODE
+{
+    JXFORM_NONE,
+    JXFORM_FLIP_H,
+    JXFORM_FLIP_V,
+    JXFORM_TRANSPOSE,
+    JXFORM_TRANSVERSE,
+    JXFORM_ROT_90,
+    JXFORM_ROT_180,
+    JXFORM_ROT_270,
+    JXFORM_WIPE,
+    JXFORM_DROP,
+}
@@ -11,6 +11,42 @@ namespace PhotoSauce.Interop.Libjpeg;
 
 internal static unsafe partial class Libjpeg
 {
+    [NativeTypeName("#define PS_SCANS_FOR_SCALE 0")]
+    public const int PS_SCANS_FOR_SCALE = 0;
+
+    [NativeTypeName("#define PS_TRANSFORM_TRIM 0x01")]
+    public const int PS_TRANSFORM_TRIM = 0x01;
+
+    [NativeTypeName("#define PS_TRANSFORM_PERFECT 0x02")]
+    public const int PS_TRANSFORM_PERFECT = 0x02;
+
+    [NativeTypeName("#define PS_TRANSFORM_OPTIMIZE 0x04")]
+    public const int PS_TRANSFORM_OPTIMIZE = 0x04;
+
+    [NativeTypeName("#define PS_TRANSFORM_PROGRESSIVE 0x08")]
+    public const int PS_TRANSFORM_PROGRESSIVE = 0x08;
+
+    [NativeTypeName("#define PS_TRANSFORM_COPY_MARKERS 0x10")]
+    public const int PS_TRANSFORM_COPY_MARKERS = 0x10;
+
+    [NativeTypeName("#define PS_JPEG_STAGE_HEADER 0")]
+    public const int PS_JPEG_STAGE_HEADER = 0;
+
+    [NativeTypeName("#define PS_JPEG_STAGE_START 1")]
+    public const int PS_JPEG_STAGE_START = 1;
+
+    [NativeTypeName("#define PS_JPEG_STAGE_PIXELS 2")]
+    public const int PS_JPEG_STAGE_PIXELS = 2;
+
+    [NativeTypeName("#define PS_JPEG_STAGE_COEFFICIENTS 3")]
+    public const int PS_JPEG_STAGE_COEFFICIENTS = 3;
+
+    [NativeTypeName("#define PS_JPEG_STAGE_FINISH 4")]
+    public const int PS_JPEG_STAGE_FINISH = 4;
+
+    [NativeTypeName("#define PS_JPEG_STAGE_COUNT 5")]
+    public const int PS_JPEG_STAGE_COUNT = 5;
+
     [DllImport("psjpeg", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
     public static extern int JpegVersion();
 
@@ -22,12 +58,26 @@ internal static unsafe partial class Libjpeg
     [return: NativeTypeName("j_decompress_ptr")]
     public static extern jpeg_decompress_struct* JpegCreateDecompress();
 
+    [DllImport("psjpeg", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    [return: NativeTypeName("j_compress_ptr")]
+    public static extern jpeg_compress_struct* JpegCreateCompressWithAllocator([NativeTypeName("const ps_allocator *")] ps_allocator* allocator, [NativeTypeName("size_t")] nuint retain);
+
+    [DllImport("psjpeg", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    [return: NativeTypeName("j_decompress_ptr")]
+    public static extern jpeg_decompress_struct* JpegCreateDecompressWithAllocator([NativeTypeName("const ps_allocator *")] ps_allocator* allocator, [NativeTypeName("size_t")] nuint retain);
+
     [DllImport("psjpeg", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
     public static extern void JpegDestroy([NativeTypeName("j_common_ptr")] jpeg_common_struct* cinfo);
 
     [DllImport("psjpeg", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
     public static extern void JpegAbortDecompress([NativeTypeName("j_decompress_ptr")] jpeg_decompress_struct* cinfo);
 
+    [DllImport("psjpeg", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern int JpegResetCompress([NativeTypeName("j_compress_ptr")] jpeg_compress_struct* cinfo);
+
+    [DllImport("psjpeg", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern int JpegResetDecompress([NativeTypeName("j_decompress_ptr")] jpeg_decompress_struct* cinfo);
+
     [DllImport("psjpeg", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
     public static extern void JpegFree(void* mem);
 
@@ -35,6 +85,24 @@ internal static unsafe partial class Libjpeg
     [return: NativeTypeName("const char *")]
     public static extern sbyte* JpegGetLastError([NativeTypeName("j_common_ptr")] jpeg_common_struct* cinfo);
 
+    [DllImport("psjpeg", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern void JpegGetStats([NativeTypeName("j_common_ptr")] jpeg_common_struct* cinfo, ps_jpeg_stats* stats);
+
+    [DllImport("psjpeg", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern void JpegResetStats([NativeTypeName("j_common_ptr")] jpeg_common_struct* cinfo);
+
+    [DllImport("psjpeg", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern int JpegSetBufferSize([NativeTypeName("j_common_ptr")] jpeg_common_struct* cinfo, [NativeTypeName("size_t")] nuint size);
+
+    [DllImport("psjpeg", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern int JpegSetMemorySource([NativeTypeName("j_decompress_ptr")] jpeg_decompress_struct* cinfo, [NativeTypeName("const JOCTET *")] byte* buff, [NativeTypeName("size_t")] nuint len);
+
+    [DllImport("psjpeg", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern int JpegSetMemoryDest([NativeTypeName("j_compress_ptr")] jpeg_compress_struct* cinfo);
+
+    [DllImport("psjpeg", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern void JpegGetMemoryDest([NativeTypeName("j_compress_ptr")] jpeg_compress_struct* cinfo, [NativeTypeName("const JOCTET **")] byte** buff, [NativeTypeName("size_t *")] nuint* len);
+
     [DllImport("psjpeg", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
     public static extern int JpegSetDefaults([NativeTypeName("j_compress_ptr")] jpeg_compress_struct* cinfo);
 
@@ -56,6 +124,9 @@ internal static unsafe partial class Libjpeg
     [DllImport("psjpeg", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
     public static extern int JpegFinishCompress([NativeTypeName("j_compress_ptr")] jpeg_compress_struct* cinfo);
 
+    [DllImport("psjpeg", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern int JpegWriteImageParallel([NativeTypeName("j_compress_ptr")] jpeg_compress_struct* cinfo, [NativeTypeName("JSAMPARRAY")] byte** scanlines, [NativeTypeName("JSAMPIMAGE")] byte*** planes, int threads);
+
     [DllImport("psjpeg", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
     public static extern int JpegWriteMarker([NativeTypeName("j_compress_ptr")] jpeg_compress_struct* cinfo, int marker, [NativeTypeName("const JOCTET *")] byte* dataptr, [NativeTypeName("unsigned int")] uint datalen);
 
@@ -86,6 +157,33 @@ internal static unsafe partial class Libjpeg
     [DllImport("psjpeg", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
     public static extern int JpegFinishDecompress([NativeTypeName("j_decompress_ptr")] jpeg_decompress_struct* cinfo);
 
+    [DllImport("psjpeg", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern int JpegDecodeScansUpTo([NativeTypeName("j_decompress_ptr")] jpeg_decompress_struct* cinfo, int max_scan);
+
+    [DllImport("psjpeg", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern int JpegGetRestartIndex([NativeTypeName("j_decompress_ptr")] jpeg_decompress_struct* cinfo, [NativeTypeName("const size_t **")] nuint** offsets, [NativeTypeName("JDIMENSION *")] uint* count);
+
+    [DllImport("psjpeg", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern int JpegDecodeBandsParallel([NativeTypeName("j_decompress_ptr")] jpeg_decompress_struct* cinfo, [NativeTypeName("JSAMPARRAY")] byte** scanlines, [NativeTypeName("JSAMPIMAGE")] byte*** planes, int threads);
+
+    [DllImport("psjpeg", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern int JpegReadCoefficients([NativeTypeName("j_decompress_ptr")] jpeg_decompress_struct* cinfo, [NativeTypeName("jvirt_barray_ptr **")] void*** coef_arrays);
+
+    [DllImport("psjpeg", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern int JpegAccessCoefficients([NativeTypeName("j_common_ptr")] jpeg_common_struct* cinfo, [NativeTypeName("jvirt_barray_ptr")] void* coef_array, [NativeTypeName("JDIMENSION")] uint start_row, [NativeTypeName("JDIMENSION")] uint num_rows, int writable, [NativeTypeName("JBLOCKARRAY *")] short*** blocks);
+
+    [DllImport("psjpeg", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern int JpegCopyCriticalParameters([NativeTypeName("j_decompress_ptr")] jpeg_decompress_struct* srcinfo, [NativeTypeName("j_compress_ptr")] jpeg_compress_struct* cinfo);
+
+    [DllImport("psjpeg", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern int JpegRequantize([NativeTypeName("j_decompress_ptr")] jpeg_decompress_struct* srcinfo, [NativeTypeName("j_compress_ptr")] jpeg_compress_struct* cinfo, [NativeTypeName("jvirt_barray_ptr *")] void** coef_arrays);
+
+    [DllImport("psjpeg", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern int JpegWriteCoefficients([NativeTypeName("j_compress_ptr")] jpeg_compress_struct* cinfo, [NativeTypeName("jvirt_barray_ptr *")] void** coef_arrays);
+
+    [DllImport("psjpeg", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern int JpegTransform([NativeTypeName("j_decompress_ptr")] jpeg_decompress_struct* srcinfo, [NativeTypeName("j_compress_ptr")] jpeg_compress_struct* cinfo, int transform, [NativeTypeName("JDIMENSION")] uint crop_x, [NativeTypeName("JDIMENSION")] uint crop_y, [NativeTypeName("JDIMENSION")] uint crop_width, [NativeTypeName("JDIMENSION")] uint crop_height, int flags);
+
     [DllImport("psjpeg", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
     public static extern int JpegSaveMarkers([NativeTypeName("j_decompress_ptr")] jpeg_decompress_struct* cinfo, int marker_code, [NativeTypeName("unsigned int")] uint length_limit);
 
@@ -0,0 +1,19 @@
+// Copyright © Clinton Ingram and Contributors
+// SPDX-License-Identifier: MIT
+
+// Ported from psjpeg.h
+// This software is based in part on the work of the Independent JPEG Group.
+// See third-party-notices in the repository root for more information.
+
+namespace PhotoSauce.Interop.Libjpeg;
+
+internal unsafe partial struct ps_allocator
+{
+    public void* state;
+
+    [NativeTypeName("void *(*)(void *, size_t)")]
+    public delegate* unmanaged[Cdecl]<void*, nuint, void*> alloc;
+
+    [NativeTypeName("void (*)(void *, void *)")]
+    public delegate* unmanaged[Cdecl]<void*, void*, void> free;
+}
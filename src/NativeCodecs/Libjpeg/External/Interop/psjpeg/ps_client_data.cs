@@ -20,4 +20,9 @@ internal unsafe partial struct ps_client_data
 
     [NativeTypeName("size_t (*)(intptr_t, size_t)")]
     public delegate* unmanaged[Cdecl]<nint, nuint, nuint> seek_callback;
+
+    [NativeTypeName("ps_arena *")]
+    public void* arena;
+
+    public ps_jpeg_stats stats;
 }
@@ -0,0 +1,35 @@
+// Copyright © Clinton Ingram and Contributors
+// SPDX-License-Identifier: MIT
+
+// Ported from psjpeg.h
+// This software is based in part on the work of the Independent JPEG Group.
+// See third-party-notices in the repository root for more information.
+
+namespace PhotoSauce.Interop.Libjpeg;
+
+internal unsafe partial struct ps_jpeg_stats
+{
+    [NativeTypeName("uint64_t")]
+    public ulong bytes_in;
+
+    [NativeTypeName("uint64_t")]
+    public ulong bytes_out;
+
+    [NativeTypeName("uint64_t")]
+    public ulong read_calls;
+
+    [NativeTypeName("uint64_t")]
+    public ulong write_calls;
+
+    [NativeTypeName("uint64_t")]
+    public ulong seek_calls;
+
+    [NativeTypeName("uint64_t")]
+    public ulong callback_ns;
+
+    [NativeTypeName("uint64_t")]
+    public ulong rows;
+
+    [NativeTypeName("uint64_t[5]")]
+    public fixed ulong stage_ns[5];
+}
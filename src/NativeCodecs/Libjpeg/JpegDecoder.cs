@@ -56,6 +56,9 @@ internal sealed unsafe class JpegContainer : IImageContainer
 		pcd->read_callback = JpegCallbacks.Read;
 		pcd->seek_callback = JpegCallbacks.Seek;
 
+		if (stream->TryGetMemory(out byte* pmem, out nuint cbmem))
+			_ = JpegSetMemorySource(handle, pmem, cbmem);
+
 		int read = JpegReadHeader(handle);
 		stream->Seek(0, SeekOrigin.Begin);
 
@@ -283,8 +286,13 @@ internal sealed unsafe class JpegFrame : IImageFrame, IPlanarDecoder, IMetadataS
 
 	public void StartDecoder()
 	{
+		// Only progressive images can stop early, and only at reduced scale, once the scans the scaled IDCT needs are in.
+		// Everything else takes the normal path, so buffered-image mode is never entered when it can't save any reads.
 		var handle = Container.GetHandle();
-		Container.CheckResult(JpegStartDecompress(handle));
+		if (handle->progressive_mode != 0 && handle->min_DCT_scaled_size < DCTSIZE)
+			Container.CheckResult(JpegDecodeScansUpTo(handle, PS_SCANS_FOR_SCALE));
+		else
+			Container.CheckResult(JpegStartDecompress(handle));
 
 		if (decodeCrop.Width < (int)handle->output_width)
 		{
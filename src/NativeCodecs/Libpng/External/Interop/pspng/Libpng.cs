@@ -21,6 +21,12 @@ internal static unsafe partial class Libpng
     [DllImport("pspng", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
     public static extern ps_png_struct* PngCreateRead();
 
+    [DllImport("pspng", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern ps_png_struct* PngCreateWriteWithAllocator([NativeTypeName("const ps_allocator *")] ps_allocator* allocator, [NativeTypeName("size_t")] nuint retain);
+
+    [DllImport("pspng", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern ps_png_struct* PngCreateReadWithAllocator([NativeTypeName("const ps_allocator *")] ps_allocator* allocator, [NativeTypeName("size_t")] nuint retain);
+
     [DllImport("pspng", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
     public static extern int PngResetRead(ps_png_struct* handle);
 
@@ -34,12 +40,33 @@ internal static unsafe partial class Libpng
     [return: NativeTypeName("const char *")]
     public static extern sbyte* PngGetLastError(ps_png_struct* handle);
 
+    [DllImport("pspng", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern void PngGetStats(ps_png_struct* handle, ps_png_stats* stats);
+
+    [DllImport("pspng", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern void PngResetStats(ps_png_struct* handle);
+
+    [DllImport("pspng", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern int PngSetBufferSize(ps_png_struct* handle, [NativeTypeName("size_t")] nuint size);
+
+    [DllImport("pspng", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern int PngSetMemorySource(ps_png_struct* handle, [NativeTypeName("png_const_bytep")] byte* buff, [NativeTypeName("size_t")] nuint len);
+
+    [DllImport("pspng", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern int PngSetMemoryDest(ps_png_struct* handle);
+
+    [DllImport("pspng", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern void PngGetMemoryDest(ps_png_struct* handle, [NativeTypeName("png_const_bytep *")] byte** buff, [NativeTypeName("size_t *")] nuint* len);
+
     [DllImport("pspng", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
     public static extern int PngSetFilter(ps_png_struct* handle, int filters);
 
     [DllImport("pspng", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
     public static extern int PngSetCompressionLevel(ps_png_struct* handle, int level);
 
+    [DllImport("pspng", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern int PngSetThreads(ps_png_struct* handle, int threads);
+
     [DllImport("pspng", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
     public static extern int PngWriteSig(ps_png_struct* handle);
 
@@ -109,9 +136,27 @@ internal static unsafe partial class Libpng
     [DllImport("pspng", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
     public static extern int PngReadImage(ps_png_struct* handle, [NativeTypeName("png_bytepp")] byte** image);
 
+    [DllImport("pspng", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern int PngReadPasses(ps_png_struct* handle, int passes, [NativeTypeName("png_bytepp")] byte** image);
+
+    [DllImport("pspng", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern void PngGetPassSize(ps_png_struct* handle, int passes, [NativeTypeName("png_uint_32 *")] uint* width, [NativeTypeName("png_uint_32 *")] uint* height);
+
     [DllImport("pspng", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
     public static extern int PngReadEnd(ps_png_struct* handle, [NativeTypeName("png_infop")] void* end_info);
 
+    [DllImport("pspng", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern int PngBuildIndex(ps_png_struct* handle, [NativeTypeName("size_t")] nuint spacing);
+
+    [DllImport("pspng", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern void PngGetIndex(ps_png_struct* handle, [NativeTypeName("png_const_bytep *")] byte** data, [NativeTypeName("size_t *")] nuint* len);
+
+    [DllImport("pspng", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern int PngSetIndex(ps_png_struct* handle, [NativeTypeName("png_const_bytep")] byte* data, [NativeTypeName("size_t")] nuint len);
+
+    [DllImport("pspng", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
+    public static extern int PngSeekRow(ps_png_struct* handle, [NativeTypeName("png_uint_32")] uint row);
+
     [DllImport("pspng", CallingConvention = CallingConvention.Cdecl, ExactSpelling = true)]
     [SuppressGCTransition]
     public static extern int PngGetValid(ps_png_struct* handle, [NativeTypeName("png_uint_32")] uint flag);
@@ -151,4 +196,19 @@ internal static unsafe partial class Libpng
 
     [NativeTypeName("#define FALSE 0")]
     public const int FALSE = 0;
+
+    [NativeTypeName("#define PS_PNG_STAGE_HEADER 0")]
+    public const int PS_PNG_STAGE_HEADER = 0;
+
+    [NativeTypeName("#define PS_PNG_STAGE_ROWS 1")]
+    public const int PS_PNG_STAGE_ROWS = 1;
+
+    [NativeTypeName("#define PS_PNG_STAGE_INDEX 2")]
+    public const int PS_PNG_STAGE_INDEX = 2;
+
+    [NativeTypeName("#define PS_PNG_STAGE_FINISH 3")]
+    public const int PS_PNG_STAGE_FINISH = 3;
+
+    [NativeTypeName("#define PS_PNG_STAGE_COUNT 4")]
+    public const int PS_PNG_STAGE_COUNT = 4;
 }
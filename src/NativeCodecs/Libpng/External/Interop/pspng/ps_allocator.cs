@@ -0,0 +1,19 @@
+// Copyright © Clinton Ingram and Contributors
+// SPDX-License-Identifier: MIT
+
+// Ported from pspng.h
+// This software is based in part on the work of the libpng authors.
+// See third-party-notices in the repository root for more information.
+
+namespace PhotoSauce.Interop.Libpng;
+
+internal unsafe partial struct ps_allocator
+{
+    public void* state;
+
+    [NativeTypeName("void *(*)(void *, size_t)")]
+    public delegate* unmanaged[Cdecl]<void*, nuint, void*> alloc;
+
+    [NativeTypeName("void (*)(void *, void *)")]
+    public delegate* unmanaged[Cdecl]<void*, void*, void> free;
+}
@@ -17,4 +17,35 @@ internal unsafe partial struct ps_io_data
 
     [NativeTypeName("size_t (*)(intptr_t, png_bytep, size_t)")]
     public delegate* unmanaged[Cdecl]<nint, byte*, nuint, nuint> read_callback;
+
+    [NativeTypeName("size_t (*)(intptr_t, size_t)")]
+    public delegate* unmanaged[Cdecl]<nint, nuint, nuint> seek_callback;
+
+    [NativeTypeName("png_bytep")]
+    public byte* buff;
+
+    [NativeTypeName("size_t")]
+    public nuint buff_size;
+
+    [NativeTypeName("size_t")]
+    public nuint buff_len;
+
+    [NativeTypeName("size_t")]
+    public nuint buff_pos;
+
+    [NativeTypeName("size_t")]
+    public nuint read_pos;
+
+    [NativeTypeName("png_const_bytep")]
+    public byte* mem;
+
+    [NativeTypeName("size_t")]
+    public nuint mem_len;
+
+    [NativeTypeName("size_t")]
+    public nuint mem_pos;
+
+    public int mem_dest;
+
+    public ps_png_stats stats;
 }
@@ -16,4 +16,10 @@ internal unsafe partial struct ps_png_struct
     public void* info_ptr;
 
     public ps_io_data* io_ptr;
+
+    [NativeTypeName("ps_mt_data *")]
+    public void* mt_ptr;
+
+    [NativeTypeName("ps_png_index *")]
+    public void* index_ptr;
 }
@@ -21,6 +21,8 @@ internal static unsafe partial class Libpng
 internal unsafe partial struct ps_io_data
 {
 	public readonly StreamWrapper* Stream => (StreamWrapper*)stream_handle;
+
+	public readonly bool IsEof() => mem is not null ? mem_pos == mem_len : buff_pos == buff_len && Stream->IsEof();
 }
 
 #if NET5_0_OR_GREATER
@@ -31,9 +33,11 @@ internal unsafe class PngCallbacks
 #if !NET5_0_OR_GREATER
 	[UnmanagedFunctionPointer(CallingConvention.Cdecl)] private delegate nuint ReadDelegate(nint pinst, byte* buff, nuint cb);
 	[UnmanagedFunctionPointer(CallingConvention.Cdecl)] private delegate nuint WriteDelegate(nint pinst, byte* buff, nuint cb);
+	[UnmanagedFunctionPointer(CallingConvention.Cdecl)] private delegate nuint SeekDelegate(nint pinst, nuint pos);
 
 	private static readonly ReadDelegate delRead = typeof(PngCallbacks).CreateMethodDelegate<ReadDelegate>(nameof(read));
 	private static readonly WriteDelegate delWrite = typeof(PngCallbacks).CreateMethodDelegate<WriteDelegate>(nameof(write));
+	private static readonly SeekDelegate delSeek = typeof(PngCallbacks).CreateMethodDelegate<SeekDelegate>(nameof(seek));
 #endif
 
 	public static readonly delegate* unmanaged[Cdecl]<nint, byte*, nuint, nuint> Read =
@@ -50,6 +54,13 @@ internal unsafe class PngCallbacks
 		(delegate* unmanaged[Cdecl]<nint, byte*, nuint, nuint>)Marshal.GetFunctionPointerForDelegate(delWrite);
 #endif
 
+	public static readonly delegate* unmanaged[Cdecl]<nint, nuint, nuint> Seek =
+#if NET5_0_OR_GREATER
+		&seek;
+#else
+		(delegate* unmanaged[Cdecl]<nint, nuint, nuint>)Marshal.GetFunctionPointerForDelegate(delSeek);
+#endif
+
 #if NET5_0_OR_GREATER
 	[UnmanagedCallersOnly(CallConvs = [typeof(CallConvCdecl)])]
 	static
@@ -86,4 +97,22 @@ internal unsafe class PngCallbacks
 			return 0;
 		}
 	}
+
+#if NET5_0_OR_GREATER
+	[UnmanagedCallersOnly(CallConvs = [typeof(CallConvCdecl)])]
+	static
+#endif
+	private nuint seek(nint pinst, nuint pos)
+	{
+		var stm = (StreamWrapper*)pinst;
+		try
+		{
+			return (nuint)stm->Seek(checked((long)pos), System.IO.SeekOrigin.Begin);
+		}
+		catch (Exception ex) when (StreamWrapper.CaptureExceptions)
+		{
+			stm->SetException(ExceptionDispatchInfo.Capture(ex));
+			return unchecked((nuint)~0ul);
+		}
+	}
 }
@@ -152,6 +152,10 @@ internal sealed unsafe class PngContainer : IImageContainer, IMetadataSource, II
 		var iod = handle->io_ptr;
 		iod->stream_handle = (nint)stream;
 		iod->read_callback = PngCallbacks.Read;
+		iod->seek_callback = PngCallbacks.Seek;
+
+		if (stream->TryGetMemory(out byte* pmem, out nuint cbmem))
+			_ = PngSetMemorySource(handle, pmem, cbmem);
 
 		if (PngReadInfo(handle) == TRUE)
 			return new PngContainer(handle, options);
@@ -177,7 +181,7 @@ internal sealed unsafe class PngContainer : IImageContainer, IMetadataSource, II
 
 		handle->io_ptr->Stream->ThrowIfExceptional();
 
-		if (!isEof && handle->io_ptr->Stream->IsEof())
+		if (!isEof && handle->io_ptr->IsEof())
 			isEof = true;
 
 		if (!isDecoding)
@@ -202,6 +206,18 @@ internal sealed unsafe class PngContainer : IImageContainer, IMetadataSource, II
 			currentFrame = 0;
 	}
 
+	// Resumes from the nearest row index checkpoint, building the index on first use.  Fails for APNG fdAT frames,
+	// in which case the caller falls back to a full reset.
+	public bool TrySeekRow(int row)
+	{
+		var handle = GetHandle();
+		if (PngSeekRow(handle, (uint)row) == TRUE)
+			return true;
+
+		handle->io_ptr->Stream->ThrowIfExceptional();
+		return false;
+	}
+
 	void IIccProfileSource.CopyProfile(Span<byte> dest) => getIccp().CopyTo(dest);
 
 	void IExifSource.CopyExif(Span<byte> dest) => getExif().CopyTo(dest);
@@ -308,10 +324,10 @@ internal sealed unsafe class PngContainer : IImageContainer, IMetadataSource, II
 	}
 }
 
-internal sealed unsafe class PngFrame : IImageFrame, IMetadataSource
+internal sealed unsafe class PngFrame : IImageFrame, IMetadataSource, IPointSampledScaledDecoder
 {
 	private readonly PngContainer container;
-	private readonly int width, height;
+	private int width, height, passes = PNG_INTERLACE_ADAM7_PASSES;
 
 	private FrameBufferSource? frameBuff;
 	private RentedBuffer<byte> lineBuff;
@@ -359,6 +375,27 @@ internal sealed unsafe class PngFrame : IImageFrame, IMetadataSource
 		return container.TryGetMetadata(out metadata);
 	}
 
+	// Interlaced still images are scaled by reading only the leading Adam7 passes, which hold a 1/8, 1/4 or 1/2 scale
+	// point-sampled copy of the image after 1, 3 or 5 passes.  Unlike the JPEG scaled IDCT, this does no filtering,
+	// so the pipeline only asks for it when speed is preferred over quality.
+	public (int width, int height) SetDecodeScale(int ratio)
+	{
+		if (frameBuff is not null)
+			throw new InvalidOperationException("Scale cannot be changed after decode has started.");
+
+		var handle = container.GetHandle();
+		if (!container.IsInterlaced || handle->HasChunk(PNG_INFO_acTL))
+			return (width, height);
+
+		passes = ratio >= 8 ? 1 : ratio >= 4 ? 3 : ratio >= 2 ? 5 : PNG_INTERLACE_ADAM7_PASSES;
+
+		uint w, h;
+		PngGetPassSize(handle, passes, &w, &h);
+		(width, height) = ((int)w, (int)h);
+
+		return (width, height);
+	}
+
 	public void Dispose()
 	{
 		frameBuff?.Dispose();
@@ -397,8 +434,15 @@ internal sealed unsafe class PngFrame : IImageFrame, IMetadataSource
 
 			if (prc.Y < lastRow)
 			{
-				container.ResetDecoder(true);
-				lastRow = 0;
+				if (container.TrySeekRow(prc.Y))
+				{
+					lastRow = prc.Y;
+				}
+				else
+				{
+					container.ResetDecoder(true);
+					lastRow = 0;
+				}
 			}
 
 			var handle = container.GetHandle();
@@ -471,7 +515,12 @@ internal sealed unsafe class PngFrame : IImageFrame, IMetadataSource
 						lspan[i] = (nint)(pbuf + i * fbuf.Stride);
 
 					fixed (nint* plines = lines)
-						container.CheckResult(PngReadImage(handle, (byte**)plines));
+					{
+						if (frame.passes < PNG_INTERLACE_ADAM7_PASSES)
+							container.CheckResult(PngReadPasses(handle, frame.passes, (byte**)plines));
+						else
+							container.CheckResult(PngReadImage(handle, (byte**)plines));
+					}
 				}
 
 				frame.frameBuff = fbuf;